@@ -0,0 +1,2215 @@
+//histogram equalisation engine, see HistogramEqualizer.h
+//the steps of an image follow the original Tutorial 2 program: histogram, cumulative histogram (with the LUT written by
+//the scan in the optimised modes) and the output image; the device, program and buffer setup is kept between images
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <future>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#include "HistogramEqualizer.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#include <malloc.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool GetPNMHeader(const string& file_name, int& width, int& height, int& channels, int& max_value, size_t* payload_offset)
+{
+	ifstream file(file_name, ios::binary);
+	string magic;
+	int fields[3] = { 0, 0, 255 };
+
+	file >> magic;
+	if (magic.size() != 2 || magic[0] != 'P' || magic[1] < '1' || magic[1] > '6')
+		return false;
+
+	//bitmaps have no maxval field, they are decoded (by CImg) to 0 and 255
+	int field_count = magic == "P1" || magic == "P4" ? 2 : 3;
+
+	for (int i = 0; i < field_count && file; )
+	{
+		file >> ws;
+		if (file.peek() == '#')
+			file.ignore(numeric_limits<streamsize>::max(), '\n');
+		else
+			file >> fields[i++];
+	}
+
+	width = fields[0];
+	height = fields[1];
+	channels = magic == "P3" || magic == "P6" ? 3 : 1;
+	max_value = fields[2];
+
+	//a single whitespace character separates the last field from the binary payload
+	if (payload_offset)
+	{
+		file.get();
+		*payload_offset = file ? (size_t)file.tellg() : 0;
+	}
+
+	return file && width > 0 && height > 0 && max_value > 0;
+}
+
+int GetPNMMaxval(const string& file_name)
+{
+	int width, height, channels, max_value;
+
+	return GetPNMHeader(file_name, width, height, channels, max_value) ? max_value : 0;
+}
+
+HostMemory::HostMemory(size_t size)
+{
+	//the size is rounded up to whole pages as well, some runtimes only use host memory in place if both are aligned
+	size = (size + alignment - 1) / alignment * alignment;
+
+#ifdef _WIN32
+	pointer = _aligned_malloc(size, alignment);
+#else
+	if (posix_memalign(&pointer, alignment, size) != 0)
+		pointer = NULL;
+#endif
+
+	if (!pointer)
+		throw std::bad_alloc();
+}
+
+HostMemory::~HostMemory()
+{
+#ifdef _WIN32
+	_aligned_free(pointer);
+#else
+	free(pointer);
+#endif
+}
+
+MappedFile::MappedFile(const string& file_name)
+	: pointer(NULL), file_size(0)
+{
+#ifdef _WIN32
+	file_handle = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	mapping_handle = NULL;
+
+	LARGE_INTEGER size;
+	if (file_handle != INVALID_HANDLE_VALUE && GetFileSizeEx(file_handle, &size) && size.QuadPart > 0)
+	{
+		file_size = (size_t)size.QuadPart;
+		mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		if (mapping_handle)
+			pointer = (unsigned char*)MapViewOfFile(mapping_handle, FILE_MAP_COPY, 0, 0, 0);
+	}
+#else
+	file_descriptor = open(file_name.c_str(), O_RDONLY);
+
+	struct stat status;
+	if (file_descriptor >= 0 && fstat(file_descriptor, &status) == 0 && status.st_size > 0)
+	{
+		file_size = (size_t)status.st_size;
+		void* mapped = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file_descriptor, 0);
+		if (mapped != MAP_FAILED)
+			pointer = (unsigned char*)mapped;
+	}
+#endif
+
+	if (!pointer)
+	{
+		Close();
+		throw std::runtime_error("Cannot map file " + file_name);
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (pointer)
+		UnmapViewOfFile(pointer);
+	if (mapping_handle)
+		CloseHandle(mapping_handle);
+	if (file_handle != INVALID_HANDLE_VALUE)
+		CloseHandle(file_handle);
+#else
+	if (pointer)
+		munmap(pointer, file_size);
+	if (file_descriptor >= 0)
+		close(file_descriptor);
+#endif
+	pointer = NULL;
+}
+
+HistogramEqualizer::HistogramEqualizer(int platform_id, int device_id, const Options& options, std::ostream& log)
+	: options(options), log_stream(log), null_log(NULL)
+{
+	// Part 3 - host operations
+	// 3.1 Select computing devices
+	context = GetContext(platform_id, device_id);
+	device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+
+	log << GetPlatformName(platform_id) << ", " << GetDeviceName(platform_id, device_id) << std::endl;
+
+	//create a queue to which we will push commands to the device, out of order where the device supports it so that
+	//commands without a dependency between them (the upload, the buffer fills and the copy) can overlap;
+	//the order of the other commands is kept by the event wait lists in Run
+	//(CL_DEVICE_QUEUE_PROPERTIES has the value of the host queue properties of OpenCL 2.0, so it is valid on every device,
+	//but cl2.hpp only declares its type for OpenCL 1.x targets)
+	cl_command_queue_properties device_queue_properties = 0;
+	device.getInfo(CL_DEVICE_QUEUE_PROPERTIES, &device_queue_properties);
+
+	cl_command_queue_properties queue_properties = CL_QUEUE_PROFILING_ENABLE;
+	if (device_queue_properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)
+		queue_properties |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+
+	queue = CreateQueue(queue_properties);
+
+	log << "Using " << (queue_properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE ? "out-of-order" : "in-order") << " command queue" << std::endl;
+
+	// 3.2 Load the device code, it is built for the bin count of an image the first time that bin count is seen
+	AddSources(sources, "kernels/my_kernels.cl");
+
+	//the kernels are specialised for the strip length of the register-blocked scan, which sizes a private array of every
+	//work-item, so long strips are capped before they spill to global memory or fail to build
+	const int max_scan_strip = 64;
+	if (this->options.scan_strip > max_scan_strip)
+		log << "The register-blocked scan strip is limited to " << max_scan_strip << " bins per work-item" << std::endl;
+	this->options.scan_strip = std::min(std::max(this->options.scan_strip, 1), max_scan_strip);
+	build_options = " -D SCAN_STRIP=" + std::to_string(this->options.scan_strip);
+
+	//devices that share the host memory (CPUs and integrated GPUs) can work on the image data in place,
+	//copies between host and device buffers are then pure overhead
+	zero_copy_supported = device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() == CL_TRUE;
+	device_little_endian = device.getInfo<CL_DEVICE_ENDIAN_LITTLE>() == CL_TRUE;
+
+	if (IsZeroCopy())
+		log << "Using zero-copy host buffers (the device shares the host memory)" << std::endl;
+
+	//sub-group aggregated histogram kernels are only compiled where the device reports a sub-group extension
+	string device_extensions = device.getInfo<CL_DEVICE_EXTENSIONS>();
+	subgroups_supported = device_extensions.find("cl_khr_subgroups") != string::npos || device_extensions.find("cl_intel_subgroups") != string::npos;
+
+	//the workgroup scans use work_group_scan_inclusive_add on OpenCL C 2.0 devices and a sub-group scan where sub-groups
+	//are supported, older devices keep the Hillis-Steele scan
+	//the version reads "OpenCL C <major>.<minor> <vendor-specific information>"
+	int c_version_major = 1, c_version_minor = 2;
+	string c_version = device.getInfo<CL_DEVICE_OPENCL_C_VERSION>();
+	std::istringstream c_version_stream(c_version.size() > 9 ? c_version.substr(9) : string());
+	int major = 0, minor = 0;
+	char separator = 0;
+
+	if (c_version_stream >> major >> separator >> minor)
+	{
+		c_version_major = major;
+		c_version_minor = minor;
+	}
+
+	if (c_version_major >= 2)
+	{
+		build_options += " -cl-std=CL" + std::to_string(c_version_major) + "." + std::to_string(c_version_minor) + " -D USE_WORK_GROUP_SCAN";
+		collective_scan_name = "work-group collective";
+	}
+	if (subgroups_supported)
+	{
+		build_options += " -D USE_SUB_GROUP_SCAN"; //used when the work-group functions are not available
+		if (collective_scan_name.empty())
+			collective_scan_name = "sub-group collective";
+	}
+}
+
+//bins of one pass of the privatized 16bit histogram (get_hist_16LC), the largest power of two range whose local histogram
+//leaves room for about four groups per compute unit next to the local memory the kernel uses itself, so the groups can hide
+//each other's latency; a pass is never narrower than 256 bins
+static size_t GetBinsPerPass(const cl::Device& device, const cl::Kernel& kernel, int bin_count)
+{
+	const cl_ulong groups_per_unit = 4;
+	cl_ulong local_mem_size = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+	cl_ulong kernel_local_mem_size = kernel.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(device);
+	cl_ulong pass_local_mem_size = (local_mem_size - std::min(local_mem_size, kernel_local_mem_size)) / groups_per_unit;
+
+	size_t bins_per_pass = bin_count;
+	while (bins_per_pass > 256 && bins_per_pass * sizeof(cl_uint) > pass_local_mem_size)
+		bins_per_pass /= 2;
+	return bins_per_pass;
+}
+
+//64bit FNV-1a hash, names the program cache files and fingerprints the kernel source
+static uint64_t HashString(const string& text, uint64_t hash = 14695981039346656037ULL)
+{
+	for (size_t i = 0; i < text.size(); i++)
+		hash = (hash ^ (unsigned char)text[i]) * 1099511628211ULL;
+	return hash;
+}
+
+cl::CommandQueue HistogramEqualizer::CreateQueue(cl_command_queue_properties properties)
+{
+	//the OpenCL 2.0 C++ API creates queues with clCreateCommandQueueWithProperties only, which 1.x platforms do not export
+	string platform_version = cl::Platform(device.getInfo<CL_DEVICE_PLATFORM>()).getInfo<CL_PLATFORM_VERSION>();
+
+	//the platform version reads "OpenCL <major>.<minor> <platform-specific information>"
+	if (platform_version.size() > 7 && std::stoi(platform_version.substr(7)) >= 2)
+		return cl::CommandQueue(context, device, properties);
+
+	cl_int error = CL_SUCCESS;
+	cl_command_queue created_queue = ::clCreateCommandQueue(context(), device(), properties, &error);
+	if (error != CL_SUCCESS)
+		throw cl::Error(error, "clCreateCommandQueue");
+
+	return cl::CommandQueue(created_queue);
+}
+
+cl::Program& HistogramEqualizer::GetProgram(const string& image_options)
+{
+	std::map<string, cl::Program>::iterator found = programs.find(image_options);
+	if (found != programs.end())
+		return found->second;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	//the kernels are specialised for the bin count and the layout of the image
+	string program_options = image_options + build_options;
+
+	//a cached binary is only valid for the same platform, device, driver, build options and kernel source; the whole key is
+	//stored in the file as well, so a hash collision or a stale file is rebuilt instead of loaded
+	string cache_key, cache_file;
+	cl::Program program;
+
+	if (!options.program_cache.empty())
+	{
+		cl::Platform platform(device.getInfo<CL_DEVICE_PLATFORM>());
+		uint64_t source_hash = 14695981039346656037ULL;
+		for (unsigned int i = 0; i < sources.size(); i++)
+			source_hash = HashString(sources[i], source_hash);
+
+		cache_key = platform.getInfo<CL_PLATFORM_NAME>() + "|" + platform.getInfo<CL_PLATFORM_VERSION>() + "|" + device.getInfo<CL_DEVICE_NAME>() + "|" +
+			device.getInfo<CL_DRIVER_VERSION>() + "|" + program_options + "|" + std::to_string(source_hash);
+
+		char file_name[32];
+		std::snprintf(file_name, sizeof(file_name), "/%016llx.bin", (unsigned long long)HashString(cache_key));
+		cache_file = options.program_cache + file_name;
+
+		ifstream file(cache_file, ios::binary);
+		string stored_key;
+		size_t binary_size = 0;
+
+		if (getline(file, stored_key) && stored_key == cache_key && file >> binary_size && file.get() == '\n' && binary_size)
+		{
+			cl::Program::Binaries binaries(1, std::vector<unsigned char>(binary_size));
+
+			if (file.read((char*)binaries[0].data(), binary_size))
+			{
+				//a binary the driver no longer accepts is rebuilt from the source
+				try
+				{
+					program = cl::Program(context, std::vector<cl::Device>(1, device), binaries);
+					program.build(program_options.c_str());
+				}
+				catch (const cl::Error&)
+				{
+					program = cl::Program();
+				}
+			}
+		}
+	}
+
+	bool cached = program() != NULL;
+
+	if (!cached)
+	{
+		program = cl::Program(context, sources);
+
+		// build and debug the kernel code
+		try
+		{
+			program.build(program_options.c_str());
+		}
+		catch (const cl::Error& err)
+		{
+			log_stream << "Build Status: " << program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(device) << std::endl;
+			log_stream << "Build Options:\t" << program.getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(device) << std::endl;
+			log_stream << "Build Log:\t " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
+			throw err;
+		}
+
+		//the binary of the device is written for later runs, a cache that cannot be written only costs the next run a build
+		if (!cache_file.empty())
+		{
+			//every directory of the path is created, the ones that exist already fail harmlessly
+			for (size_t end = options.program_cache.find_first_of("/\\", 1); ; end = options.program_cache.find_first_of("/\\", end + 1))
+			{
+				string directory = options.program_cache.substr(0, end);
+#ifdef _WIN32
+				_mkdir(directory.c_str());
+#else
+				mkdir(directory.c_str(), 0755);
+#endif
+				if (end == string::npos)
+					break;
+			}
+
+			cl::Program::Binaries binaries = program.getInfo<CL_PROGRAM_BINARIES>();
+			ofstream file(cache_file, ios::binary);
+
+			if (!binaries.empty() && !binaries[0].empty())
+			{
+				file << cache_key << '\n' << binaries[0].size() << '\n';
+				file.write((const char*)binaries[0].data(), binaries[0].size());
+			}
+
+			if (!file)
+				log_stream << "Cannot write the program binary cache file " << cache_file << std::endl;
+		}
+	}
+
+	//cold startups build from the source, warm startups load the cached binary
+	log_stream << (cached ? "Program loaded from the binary cache (warm start) in " : "Program built from source (cold start) in ") <<
+		std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000 << "ms" << std::endl;
+
+	return programs[image_options] = program;
+}
+
+cl::Kernel HistogramEqualizer::GetKernel(const string& image_options, const string& name, int instance)
+{
+	string key = image_options + " " + name + " " + std::to_string(instance);
+
+	std::map<string, cl::Kernel>::iterator found = kernels.find(key);
+	if (found != kernels.end())
+		return found->second;
+
+	return kernels[key] = cl::Kernel(GetProgram(image_options), name.c_str());
+}
+
+bool HistogramEqualizer::HasKernel(const string& image_options, const string& name)
+{
+	string kernel_names = ";" + GetProgram(image_options).getInfo<CL_PROGRAM_KERNEL_NAMES>() + ";";
+
+	return kernel_names.find(";" + name + ";") != string::npos;
+}
+
+cl::Buffer HistogramEqualizer::GetBuffer(const string& name, size_t size)
+{
+	std::pair<cl::Buffer, size_t>& buffer = buffers[name];
+
+	if (buffer.second < size)
+		buffer = std::make_pair(cl::Buffer(context, CL_MEM_READ_WRITE, size), size);
+
+	return buffer.first;
+}
+
+void HistogramEqualizer::Run(void* data, size_t pixel_size, int width, int height, int spectrum, int max_value, bool pnm_payload, BatchSlot* slot, void* output)
+{
+	//in batch mode only the first image logs its kernel choices, the histograms and timings are not read back
+	std::ostream& log = slot && !slot->verbose ? null_log : log_stream;
+	bool print_histograms = options.print_histograms && !slot;
+
+	//the options are adjusted to the image and the device below, so every image starts from the options of the engine
+	int mode_id = options.mode_id;
+	int pixels_per_item = options.pixels_per_item;
+	bool vectorised = options.vectorised;
+	bool subgroups = options.subgroups;
+	int replicas = options.replicas;
+	bool colour = options.colour;
+	bool luminance = options.luminance;
+	int scan_strategy = options.scan_strategy;
+	int scan_strip = options.scan_strip;
+	bool keep_chist = options.keep_chist;
+	bool in_place = options.in_place;
+	bool copy_benchmark = options.copy_benchmark;
+
+	//images outside of a batch are wrapped in buffers over the input and output data of the caller instead of being copied,
+	//the batch keeps its own image buffers so that transfers and kernels of consecutive images overlap
+	bool zero_copy = IsZeroCopy() && !slot;
+
+	//the equalised image is written over the input data when there is no output data; two zero-copy buffers cannot share
+	//that memory, so the device then equalises in place as well, while a separate output always gets its own buffer so the
+	//input of the caller is only read
+	void* output_data = output ? output : data;
+	if (zero_copy)
+		in_place = output_data == data;
+
+	size_t input_image_elements = (size_t)width * height * spectrum; // number of elements
+	size_t input_image_size = input_image_elements * pixel_size; // size in bytes
+
+	//image bin numbers, 8bit data uses the 256 bins of the 8bit kernels, 16bit data the maxval rounded up to a power of two
+	//(at least 512) so that a 10 or 12bit image only needs 1024 or 4096 bins
+	max_value = std::min(max_value, pixel_size == 1 ? 255 : 65535);
+
+	int bin_count = pixel_size == 1 ? 256 : 512;
+	while (bin_count <= max_value)
+		bin_count *= 2;
+
+	log << "Image maxval " << max_value << ", " << bin_count << " bins" << std::endl;
+
+	if (luminance && spectrum != 3)
+	{
+		log << "Luminance mode needs an RGB image, falling back to a shared histogram" << std::endl;
+		luminance = false;
+	}
+
+	//in colour mode every channel gets its own histogram, the channel histograms are laid out side by side;
+	//otherwise all channels share one histogram (in luminance mode a histogram of Y computed on the fly)
+	colour = colour && !luminance;
+	int channels = colour ? spectrum : 1;
+	size_t plane_elements = (size_t)width * height;
+
+	if (colour || luminance)
+	{
+		pixels_per_item = 0;
+		vectorised = false;
+		subgroups = false;
+		replicas = 1;
+	}
+
+	//the program is built for the bin count, a raw PNM payload also needs its big-endian 16bit samples swapped on
+	//little-endian devices and its interleaved channels indexed where the kernels tell the channels apart
+	bool swap_bytes = pnm_payload && pixel_size == 2 && device_little_endian;
+	string image_options = "-D BIN_COUNT=" + std::to_string(bin_count);
+
+	if (swap_bytes)
+		image_options += " -D SWAP_BYTES";
+	if (pnm_payload && spectrum > 1 && (colour || luminance))
+		image_options += " -D INTERLEAVED_CHANNELS=" + std::to_string(spectrum);
+
+	if (pnm_payload)
+		log << "Equalising the PNM payload as stored in the file (interleaved channels" << (swap_bytes ? ", byte-swapped samples)" : ")") << std::endl;
+
+	// Part 4 - memory allocation
+	typedef unsigned int standard; //use unsigned int to avoid overflow
+	std::vector<standard> H(bin_count * channels, 0); //vector to store hist
+	size_t H_elements = H.size();
+	size_t H_size = H_elements * sizeof(standard);
+
+	std::vector<standard> CH(H_elements, 0); //vector to store c-hist
+	size_t CH_elements = CH.size();
+	size_t CH_size = CH_elements * sizeof(standard);
+
+
+	//number of local elements is taken from the num of bins (8bit)
+	//8bit only needs one workgroup
+	size_t local_elements_8 = 256;
+	size_t local_size_8 = local_elements_8 * sizeof(standard);
+
+	//the Blelloch scan handles two bins per work-item and pads its local array by one entry every 32 entries
+	size_t local_size_8_BL = (local_elements_8 + local_elements_8 / 32) * sizeof(standard);
+
+	//the register-blocked scan covers the 256 bins with one strip of scan_strip bins per work-item
+	size_t local_elements_8_RB = (local_elements_8 + scan_strip - 1) / scan_strip;
+	size_t local_size_8_RB = local_elements_8_RB * sizeof(standard);
+
+	//adjusts the length of global elements of the histogram kernel for an 8-bit image;
+	//this is to try and ensure that the global size is a multiple of the local size for the padding 
+	size_t kernel1_global_elements_8 = input_image_elements;
+
+	size_t kernel1_global_elements_8_padding = kernel1_global_elements_8 % local_elements_8;
+	if (kernel1_global_elements_8_padding)
+		kernel1_global_elements_8 += (local_elements_8 - kernel1_global_elements_8_padding);
+
+	//the luminance histogram has one work-item per pixel rather than per element
+	size_t kernel1_global_elements_Y = plane_elements;
+
+	size_t kernel1_global_elements_Y_padding = kernel1_global_elements_Y % local_elements_8;
+	if (kernel1_global_elements_Y_padding)
+		kernel1_global_elements_Y += (local_elements_8 - kernel1_global_elements_Y_padding);
+
+	//vectorised kernels process vector_width pixels per work-item;
+	//the tail that is not a multiple of the vector width is handled by the scalar kernels launched at an offset
+	size_t vector_width = bin_count == 256 ? 16 : 8;
+	size_t vector_elements = input_image_elements / vector_width;
+	size_t tail_offset = vector_elements * vector_width;
+	size_t tail_elements = input_image_elements - tail_offset;
+	vectorised = vectorised && vector_elements > 0;
+
+	size_t kernel1_global_elements_8_V = vector_elements;
+
+	size_t kernel1_global_elements_8_V_padding = kernel1_global_elements_8_V % local_elements_8;
+	if (kernel1_global_elements_8_V_padding)
+		kernel1_global_elements_8_V += (local_elements_8 - kernel1_global_elements_8_V_padding);
+
+	//the privatized 16bit histogram sweeps the bins in passes of a power of two bin range
+	cl_ulong local_mem_size = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+
+	size_t bins_per_pass_16 = GetBinsPerPass(device, GetKernel(image_options, "get_hist_16LC"), bin_count);
+	size_t pass_count_16 = bin_count / bins_per_pass_16;
+
+	//replicated local histograms are padded to 257 bins each and limited by the local memory and workgroup size
+	size_t max_replicas = std::min((size_t)(local_mem_size / (257 * sizeof(standard))), local_elements_8);
+	replicas = (int)std::min((size_t)std::max(replicas, 1), max_replicas);
+	size_t local_size_8_R = replicas * 257 * sizeof(standard);
+
+	if (subgroups && !subgroups_supported)
+	{
+		log << "Sub-groups are not supported by the device, falling back to the default histogram kernels" << std::endl;
+		subgroups = false;
+	}
+
+	//the sub-group kernels are only compiled when the device compiler defines the extension macro as well,
+	//which not every driver that lists the extension does
+	if (subgroups && !HasKernel(image_options, bin_count == 256 ? "get_hist_8LC_SG" : "get_hist_16_SG"))
+	{
+		log << "The sub-group histogram kernels are not available in the device compiler, falling back to the default histogram kernels" << std::endl;
+		subgroups = false;
+	}
+
+	//the grid-stride histogram kernels launch a bounded number of groups, sized from the compute units and an occupancy factor;
+	//each work-item then covers at least pixels_per_item pixels so small images do not launch idle groups
+	size_t occupancy_factor = 4;
+	size_t max_hist_group_count = (size_t)device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * occupancy_factor;
+	size_t min_pixels_per_item = pixels_per_item > 0 ? pixels_per_item : 1;
+
+	size_t hist_group_count_8 = std::min(max_hist_group_count, (input_image_elements + local_elements_8 * min_pixels_per_item - 1) / (local_elements_8 * min_pixels_per_item));
+	size_t kernel1_global_elements_8_GS = hist_group_count_8 * local_elements_8;
+
+	size_t hist_local_elements_16 = std::min((size_t)256, GetKernel(image_options, "get_hist_16LC").getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+	size_t hist_group_count_16 = std::min(max_hist_group_count, (input_image_elements + hist_local_elements_16 * min_pixels_per_item - 1) / (hist_local_elements_16 * min_pixels_per_item));
+	size_t kernel1_global_elements_16 = hist_group_count_16 * hist_local_elements_16;
+
+	//the vectorised output kernels cache the LUT in local memory when it fits, otherwise a 16bit LUT is read through
+	//the constant cache when it fits there; they launch a bounded number of groups so every group copies the LUT once
+	size_t output_LUT_size = bin_count * (bin_count == 256 ? sizeof(unsigned char) : sizeof(unsigned short));
+	bool local_LUT = output_LUT_size <= local_mem_size;
+	bool constant_LUT = !local_LUT && output_LUT_size <= device.getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>();
+	size_t output_group_count = std::min(max_hist_group_count, (vector_elements + local_elements_8 - 1) / local_elements_8);
+
+	//16bit image size segment
+	//the scan kernels (and the block sum helpers of the multi-level and radix scans) are launched with the same workgroup size,
+	//so it is the smallest one the compiler allows for any of them
+	const char* scan_kernel_names[] = { "get_chist_HS", "get_chist_BL", "get_chist_LB", "get_scan_blocks", "get_scan_blocks_RB",
+		"get_add_block_sums", "get_complete_chist" };
+	size_t local_elements_16 = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+
+	for (size_t i = 0; i < sizeof(scan_kernel_names) / sizeof(scan_kernel_names[0]); i++)
+		local_elements_16 = std::min(local_elements_16, GetKernel(image_options, scan_kernel_names[i]).getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+
+	//obtain max workgroup size
+	size_t local_size_16 = local_elements_16 * sizeof(standard);
+	size_t local_size_16_BL = (local_elements_16 + local_elements_16 / 32) * sizeof(standard);
+
+	//the Blelloch tree needs power of two blocks
+	if (scan_strategy == 1 && bin_count > 256 && (local_elements_16 & (local_elements_16 - 1)))
+	{
+		log << "The Blelloch scan needs a power of two workgroup size, falling back to the Hillis-Steele scan" << std::endl;
+		scan_strategy = 0;
+	}
+	size_t scan_items_per_block = scan_strategy == 1 ? 2 : 1; //bins scanned by every work-item of the per-block scan
+	size_t scan_local_elements_8 = scan_strategy == 2 ? local_elements_8_RB : local_elements_8 / scan_items_per_block; //work-items of the 8bit scan
+	string scan_name = scan_strategy == 1 ? "Blelloch" : (collective_scan_name.empty() ? "Hillis-Steele" : collective_scan_name);
+
+	if (scan_strategy == 2)
+		scan_name = "register-blocked (" + std::to_string(scan_strip) + " bins per work-item)";
+
+	//when every work-item only has to scan a short strip of bins (a 12bit image has 4096 bins),
+	//the cumulative histogram of a channel is scanned by a single workgroup and the block sum helper kernels are skipped;
+	//the workgroup is limited by the kernel and by the local memory, which holds two values per work-item
+	size_t max_strip_bins = 16;
+	size_t max_scan_local_elements = std::min(GetKernel(image_options, "get_chist_BC").getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+		(size_t)(local_mem_size / (2 * sizeof(standard))));
+	size_t scan_local_elements = 1;
+	while (scan_local_elements * 2 <= std::min((size_t)bin_count, max_scan_local_elements))
+		scan_local_elements *= 2;
+	bool single_group_scan = bin_count > 256 && (size_t)bin_count <= max_strip_bins * scan_local_elements;
+
+	//the sort-based engine only replaces the shared 16bit histogram
+	if (mode_id == 3 && (bin_count == 256 || colour || luminance || swap_bytes))
+	{
+		log << "The sort-based engine needs a 16-bit image in device byte order with a shared histogram, falling back to mode 0" << std::endl;
+		mode_id = 0;
+	}
+
+	//16bit cumulative histograms of more than one block are scanned in a single pass with a decoupled look-back in mode 0,
+	//mode 1 (and mode 0 when the workgroup size does not divide the bins) runs the multi-level block sum scan
+	bool lookback_scan = mode_id == 0 && bin_count > 256 && !single_group_scan && bin_count % local_elements_16 == 0;
+	bool block_sum_scan = (mode_id == 0 || mode_id == 1) && bin_count > 256 && !single_group_scan && !lookback_scan;
+
+	//the register-blocked scan covers scan_strip values per work-item, so its blocks are scan_strip times larger
+	size_t scan_block_elements = local_elements_16 * (scan_strategy == 2 ? scan_strip : 1);
+	size_t group_count = 1; //blocks per channel
+
+	if (lookback_scan)
+		group_count = bin_count / local_elements_16;
+	else if (block_sum_scan)
+		group_count = (bin_count + scan_block_elements - 1) / scan_block_elements;
+
+	//every level of the multi-level scan is scanned in blocks of scan_block_elements values per channel and the block totals
+	//form the next level, until a single block per channel is left; this works for any bin count and workgroup size
+	std::vector<size_t> scan_level_elements; //values per channel of every level
+
+	for (size_t elements = bin_count; block_sum_scan; elements = (elements + scan_block_elements - 1) / scan_block_elements)
+	{
+		scan_level_elements.push_back(elements);
+		if (elements <= scan_block_elements)
+			break;
+	}
+
+	if (lookback_scan)
+		scan_name = "single-pass look-back";
+
+	//plain 8bit images in mode 0 run the fused histogram, scan and LUT kernel, so only it and the output kernel are launched
+	bool fused_hist = mode_id == 0 && bin_count == 256 && !colour && !luminance && pixels_per_item == 0 && replicas == 1
+		&& !vectorised && !subgroups && scan_strategy == 0;
+
+	//the optimised scans normalise the c-hist into the LUT in their last step, so get_LUT is only launched by the
+	//basic and sort-based engines; the c-hist buffer is then only needed by those engines, as the working array
+	//of the multi-level scan or when it is asked for
+	bool scan_LUT = mode_id == 0 || mode_id == 1;
+	bool chist_buffer = keep_chist || !scan_LUT || block_sum_scan;
+
+	//each histogram counts every element of its channel, or every element of the image when the channels share one
+	standard pixel_count = (standard)(colour || luminance ? plane_elements : input_image_elements);
+
+	//the radix sort groups are chosen so that the digit-major count array (16 digits per group) is a power of two number
+	//of get_chist_HS blocks, which lets get_scanned_BS_2 scan the block sums in one workgroup
+	size_t radix_local_elements = std::min((size_t)256, GetKernel(image_options, "get_radix_scatter").getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+	size_t radix_scan_blocks = 1;
+	while (local_elements_16 * radix_scan_blocks * 2 / 16 <= max_hist_group_count && radix_scan_blocks * 2 <= local_elements_16)
+		radix_scan_blocks *= 2;
+	size_t radix_scan_elements = local_elements_16 * radix_scan_blocks;
+	size_t radix_group_count = radix_scan_elements / 16;
+
+	//only as many 4-bit digits are sorted as the bin count needs
+	int radix_passes = 0;
+	while ((1 << (radix_passes * 4)) < bin_count)
+		radix_passes++;
+
+
+	//adjusting the length of global elements for 16bit
+	// trying to get the global size to be a multiple of the local size for the padding
+	size_t kernel2_global_elements_16 = H_elements;
+
+	size_t kernel2_global_elements_16_padding = kernel2_global_elements_16 % local_elements_16;
+	if (kernel2_global_elements_16_padding)
+		kernel2_global_elements_16 += (local_elements_16 - kernel2_global_elements_16_padding);
+
+	//using a vector to store the block sums
+	std::vector<standard> BS(group_count * channels, 0);
+	size_t BS_size = BS.size() * sizeof(standard);
+
+	//look-back status: a block ticket counter and a flag, aggregate and inclusive prefix per block
+	size_t LB_status_size = (1 + 3 * group_count * channels) * sizeof(standard);
+	std::vector<unsigned short> LUT(CH_elements, 0);//using a vector to store the LUT
+
+	//a LUT for a c-hist, stored in the pixel type of the image
+	size_t LUT_size = LUT.size() * (bin_count == 256 ? sizeof(unsigned char) : sizeof(unsigned short));
+
+	// Part 5 - device operations
+	// device - buffers, kept by the engine and only reallocated when this image needs larger ones
+	//every slot of a batch has its own image buffers, so an image can be uploaded while the one before it is equalised
+	string image_buffer_suffix = slot ? "_" + std::to_string(slot->index) : "";
+
+	cl::Buffer buffer_input_image;
+
+	if (zero_copy)
+	{
+		buffer_input_image = cl::Buffer(context, (in_place ? CL_MEM_READ_WRITE : CL_MEM_READ_ONLY) | CL_MEM_USE_HOST_PTR, input_image_size, data);
+
+		if ((uintptr_t)data % HostMemory::alignment || (uintptr_t)output_data % HostMemory::alignment)
+			log << "Image data is not page aligned, the runtime may copy it" << std::endl;
+	}
+	else
+		buffer_input_image = GetBuffer("input_image" + image_buffer_suffix, input_image_size);
+
+	//histogram buffer
+	cl::Buffer buffer_H = GetBuffer("H", H_size);
+
+	//c-hist buffer, a NULL buffer tells the scan kernels not to store the c-hist
+	cl::Buffer buffer_CH;
+
+	if (chist_buffer)
+		buffer_CH = GetBuffer("CH", CH_size);
+
+	//block sum buffers for every level of the multi-level scan (the first holds BS) or status buffer for the look-back scan
+	std::vector<cl::Buffer> buffer_level_BS;
+	cl::Buffer buffer_LB_status;
+
+	for (unsigned int level = 0; level < scan_level_elements.size(); level++)
+		buffer_level_BS.push_back(GetBuffer("level_BS_" + std::to_string(level), channels * ((scan_level_elements[level] + scan_block_elements - 1) / scan_block_elements) * sizeof(standard)));
+
+	if (lookback_scan)
+		buffer_LB_status = GetBuffer("LB_status", LB_status_size);
+
+	// LUT buffer
+	cl::Buffer buffer_LUT = GetBuffer("LUT", LUT_size);
+
+	//output image buffer, the input buffer itself in in-place mode so no second image sized buffer is created,
+	//a buffer over the output data of the caller with zero-copy buffers
+	cl::Buffer buffer_output_image;
+
+	if (in_place)
+		buffer_output_image = buffer_input_image;
+	else if (zero_copy)
+		buffer_output_image = cl::Buffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, input_image_size, output_data);
+	else
+		buffer_output_image = GetBuffer("output_image" + image_buffer_suffix, input_image_size);
+
+	//scratch buffer of the reference copy, only allocated when the copy is benchmarked
+	cl::Buffer buffer_copy_reference;
+
+	if (copy_benchmark)
+		buffer_copy_reference = GetBuffer("copy_reference" + image_buffer_suffix, input_image_size);
+
+	//accumulated histogram and completion counter of the fused kernel, zeroed when they are created and cleared by the kernel
+	if (fused_hist && !buffer_H_sum())
+	{
+		std::vector<standard> zeros(H_elements + 1, 0);
+		buffer_H_sum = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, H_size, &zeros[0]);
+		buffer_counter = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(standard), &zeros[0]);
+	}
+
+	//sort-based engine buffers: two key buffers for the radix sort passes, digit counts, their scan and its block sums
+	cl::Buffer buffer_keys_A, buffer_keys_B, buffer_radix_counts, buffer_radix_offsets, buffer_radix_BS;
+
+	if (mode_id == 3)
+	{
+		buffer_keys_A = GetBuffer("keys_A", input_image_size);
+		buffer_keys_B = GetBuffer("keys_B", input_image_size);
+		buffer_radix_counts = GetBuffer("radix_counts", radix_scan_elements * sizeof(standard));
+		buffer_radix_offsets = GetBuffer("radix_offsets", radix_scan_elements * sizeof(standard));
+		buffer_radix_BS = GetBuffer("radix_BS", radix_scan_blocks * sizeof(standard));
+	}
+
+	// 5.1 Copy the image to and initialise other arrays on device memory
+	//the commands of an image form a graph: every stage waits for the events of the stages it reads from, so on an
+	//out-of-order queue the fills run alongside the upload and the host only blocks once, for the output
+	cl::Event input_image_event, H_input_event, CH_input_event, LB_status_input_event, LUT_input_event;
+	vector<cl::Event> upload_events; //the image is on the device
+	vector<cl::Event> hist_wait, scan_wait, LUT_wait, output_wait, download_wait;
+
+	if (slot)
+	{
+		//the upload runs on its own queue once the previous image of the slot has left the buffers,
+		//the kernels of the image wait for it and for the previous image (which shares the other buffers) behind a barrier
+		vector<cl::Event> upload_wait;
+		if (slot->download())
+			upload_wait.push_back(slot->download);
+
+		upload_queue.enqueueWriteBuffer(buffer_input_image, CL_FALSE, 0, input_image_size, data, upload_wait.empty() ? NULL : &upload_wait, &slot->upload);
+
+		vector<cl::Event> compute_wait(1, slot->upload);
+		if (last_compute_end())
+			compute_wait.push_back(last_compute_end);
+
+		queue.enqueueBarrierWithWaitList(&compute_wait, &slot->compute_start);
+		upload_events.push_back(slot->compute_start);
+	}
+	else if (zero_copy)
+	{
+		//nothing to upload, the marker stands in for the upload in the graph and in the timings
+		queue.enqueueMarkerWithWaitList(NULL, &input_image_event);
+		upload_events.push_back(input_image_event);
+	}
+	else
+	{
+		queue.enqueueWriteBuffer(buffer_input_image, CL_FALSE, 0, input_image_size, data, NULL, &input_image_event);
+		upload_events.push_back(input_image_event);
+	}
+
+	//in batch mode the fills wait for the barrier as well, the kernels of the previous image may still use the buffers
+	vector<cl::Event>* fill_wait = slot ? &upload_events : NULL;
+	hist_wait = upload_events;
+
+	//the fused kernel writes H, CH and the LUT completely
+	if (!fused_hist)
+	{
+		//histogram buffer 0
+		queue.enqueueFillBuffer(buffer_H, 0, 0, H_size, fill_wait, &H_input_event);
+		hist_wait.push_back(H_input_event);
+
+		//c-hist buffer 0
+		if (chist_buffer)
+		{
+			queue.enqueueFillBuffer(buffer_CH, 0, 0, CH_size, fill_wait, &CH_input_event);
+			scan_wait.push_back(CH_input_event);
+		}
+
+		//LUT buffer 0
+		queue.enqueueFillBuffer(buffer_LUT, 0, 0, LUT_size, fill_wait, &LUT_input_event);
+		scan_wait.push_back(LUT_input_event);
+	}
+
+	if (lookback_scan)
+	{
+		queue.enqueueFillBuffer(buffer_LB_status, 0, 0, LB_status_size, fill_wait, &LB_status_input_event); //0 tickets and flags
+		scan_wait.push_back(LB_status_input_event);
+	}
+
+	// 5.2 Setup and execute the kernel
+	cl::Kernel kernel1, kernel1_tail, kernel2, kernel2_helper1;
+	std::vector<cl::Kernel> scan_helpers; //kernels of the multi-level scan after kernel2, with their launch sizes
+	std::vector<cl::NDRange> scan_helper_global, scan_helper_local;
+	cl::Kernel radix_counts, radix_scatter, radix_scan, radix_scan_helper1, radix_scan_helper2, radix_scan_helper3;
+	bool vectorised_hist = false; //set when kernel1 is a vectorised kernel that needs a scalar tail launch
+	bool subgroup_hist = false; //set when kernel1 is a sub-group aggregated kernel
+	bool replicated_hist = false; //set when kernel1 keeps replicated local histograms
+
+	//use am optimised version if any are available
+	if (mode_id == 0 || mode_id == 1)
+	{
+		if (fused_hist)
+		{
+			log << "Using fused histogram, cumulative histogram and LUT kernel" << std::endl;
+
+			kernel1 = GetKernel(image_options, "get_hist_LUT_8");
+
+			kernel1.setArg(2, buffer_CH);
+
+			kernel1.setArg(3, buffer_LUT);
+
+			kernel1.setArg(4, buffer_H_sum);
+
+			kernel1.setArg(5, buffer_counter);
+
+			kernel1.setArg(6, cl::Local(local_size_8)); //local histogram
+
+			kernel1.setArg(7, cl::Local(local_size_8)); //scan of the last group
+
+			kernel1.setArg(8, cl::Local(local_size_8));
+
+			kernel1.setArg(9, (standard)input_image_elements);
+
+			kernel1.setArg(10, max_value);
+		}
+		else if (bin_count == 256)
+		{
+			log << "Using optimised histogram and cumulative histogram kernels" << std::endl;
+
+			//get a hist with a specified number of bins
+			if (luminance)
+			{
+				log << "Using fused luminance histogram kernel" << std::endl;
+
+				kernel1 = GetKernel(image_options, "get_hist_Y8");
+			}
+			else if (colour)
+			{
+				log << "Using per-channel histogram kernel (" << channels << " channels)" << std::endl;
+
+				kernel1 = GetKernel(image_options, "get_hist_8LC_C");
+			}
+			else if (pixels_per_item > 0)
+			{
+				log << "Using coarsened histogram kernel (" << hist_group_count_8 << " workgroup(s), " << pixels_per_item << " pixel(s) per work-item minimum)" << std::endl;
+
+				kernel1 = GetKernel(image_options, "get_hist_8LC_GS");
+			}
+			else if (replicas > 1)
+			{
+				log << "Using replicated local histogram kernel (" << replicas << " replicas)" << std::endl;
+
+				kernel1 = GetKernel(image_options, "get_hist_8LC_R");
+				replicated_hist = true;
+			}
+			else if (vectorised)
+			{
+				kernel1 = GetKernel(image_options, "get_hist_8LC_V");
+				kernel1_tail = GetKernel(image_options, "get_hist_8");
+				vectorised_hist = true;
+			}
+			else if (subgroups)
+			{
+				log << "Using sub-group aggregated histogram kernel" << std::endl;
+
+				kernel1 = GetKernel(image_options, "get_hist_8LC_SG");
+				subgroup_hist = true;
+			}
+			else
+				kernel1 = GetKernel(image_options, "get_hist_8LC");
+
+
+			kernel2 = GetKernel(image_options, scan_strategy == 1 ? "get_chist_BL" : (scan_strategy == 2 ? "get_scan_blocks_RB" : "get_chist_HS"));
+			//get a c-hist
+
+
+			kernel1.setArg(2, cl::Local(replicated_hist ? local_size_8_R : local_size_8 * channels));
+			//local memory size for a local histogram
+
+
+			if (luminance)
+				kernel1.setArg(3, (standard)plane_elements);
+			else
+				kernel1.setArg(3, vectorised_hist ? (standard)vector_elements : (standard)input_image_elements);
+
+			if (colour)
+			{
+				kernel1.setArg(4, (standard)plane_elements);
+
+				kernel1.setArg(5, (standard)H_elements);
+			}
+
+			if (replicated_hist)
+				kernel1.setArg(4, (standard)replicas);
+
+
+			//a workgroup scans the 256 bins of a channel, so the scan writes the LUT as well
+			if (scan_strategy == 1)
+			{
+				kernel2.setArg(2, cl::Local(local_size_8_BL));
+
+				kernel2.setArg(3, buffer_LUT);
+
+				kernel2.setArg(4, (standard)max_value);
+
+				kernel2.setArg(5, pixel_count);
+			}
+			else if (scan_strategy == 2)
+			{
+				kernel2.setArg(2, cl::Buffer()); //one block per channel, no block sums
+
+				kernel2.setArg(3, (standard)local_elements_8);
+
+				kernel2.setArg(4, cl::Local(local_size_8_RB));
+
+				kernel2.setArg(5, cl::Local(local_size_8_RB));
+
+				kernel2.setArg(6, buffer_LUT);
+
+				kernel2.setArg(7, (standard)max_value);
+
+				kernel2.setArg(8, pixel_count);
+			}
+			else
+			{
+				kernel2.setArg(2, cl::Local(local_size_8));
+
+
+				kernel2.setArg(3, cl::Local(local_size_8));
+				//local memory size for a c-hist
+
+				kernel2.setArg(4, buffer_LUT);
+
+				kernel2.setArg(5, (standard)max_value);
+
+				kernel2.setArg(6, pixel_count);
+			}
+		}
+
+		else
+		{
+			if (luminance)
+			{
+				log << "Using fused luminance histogram kernel" << std::endl;
+
+				kernel1 = GetKernel(image_options, "get_hist_Y16");
+
+				kernel1.setArg(2, (standard)plane_elements);
+			}
+			else if (subgroups)
+			{
+				log << "Using sub-group aggregated histogram kernel" << std::endl;
+
+				kernel1 = GetKernel(image_options, "get_hist_16_SG");
+				subgroup_hist = true;
+
+				kernel1.setArg(2, (standard)input_image_elements);
+			}
+			else
+			{
+				log << "Using privatized histogram kernel (" << pass_count_16 * channels << " pass(es) of " << bins_per_pass_16 << " bins)" << std::endl;
+
+				//get a histogram from local sub-histograms swept over the bin range
+				kernel1 = GetKernel(image_options, "get_hist_16LC");
+
+				kernel1.setArg(2, cl::Local(bins_per_pass_16 * sizeof(standard)));
+
+				kernel1.setArg(3, (standard)input_image_elements);
+
+				kernel1.setArg(4, (standard)bins_per_pass_16);
+
+				kernel1.setArg(5, (standard)(colour ? plane_elements : input_image_elements));
+
+				kernel1.setArg(6, (standard)H_elements);
+			}
+
+			if (single_group_scan)
+			{
+				log << "Using single workgroup cumulative histogram kernel (" << bin_count / scan_local_elements << " bin(s) per work-item)" << std::endl;
+
+				kernel2 = GetKernel(image_options, "get_chist_BC");
+
+				kernel2.setArg(2, cl::Local(scan_local_elements * sizeof(standard)));
+
+				kernel2.setArg(3, cl::Local(scan_local_elements * sizeof(standard)));
+
+				kernel2.setArg(4, buffer_LUT);
+
+				kernel2.setArg(5, (standard)max_value);
+
+				kernel2.setArg(6, pixel_count);
+			}
+			else if (lookback_scan)
+			{
+				log << "Using single-pass look-back cumulative histogram kernel (" << group_count * channels << " blocks)" << std::endl;
+
+				kernel2 = GetKernel(image_options, "get_chist_LB");
+
+				kernel2.setArg(2, buffer_LB_status);
+
+				kernel2.setArg(3, (standard)group_count);
+
+				kernel2.setArg(4, cl::Local(local_size_16));
+
+				kernel2.setArg(5, cl::Local(local_size_16));
+
+				kernel2.setArg(6, buffer_LUT);
+
+				kernel2.setArg(7, (standard)max_value);
+
+				kernel2.setArg(8, pixel_count);
+			}
+			else
+			{
+				log << "Using multi-level cumulative histogram scan (" << scan_level_elements.size() << " level(s), " << scan_name << " block scan)" << std::endl;
+
+				//the LUT is written by the last kernel that touches the first level: its block scan when there is only one level,
+				//otherwise the propagation of the block sums into it
+				bool single_level = scan_level_elements.size() == 1;
+
+				//up the levels: scan every level in blocks, the block totals are scanned by the next level in place
+				for (unsigned int level = 0; level < scan_level_elements.size(); level++)
+				{
+					size_t level_blocks = channels * ((scan_level_elements[level] + scan_block_elements - 1) / scan_block_elements);
+
+					//the first level can use the Blelloch block scan, its block sums are then picked up by get_B_S
+					if (level == 0 && scan_strategy == 1)
+					{
+						kernel2 = GetKernel(image_options, "get_chist_BL");
+
+						kernel2.setArg(2, cl::Local(local_size_16_BL)); //set padded local memory for the scan tree
+
+						kernel2.setArg(3, single_level ? buffer_LUT : cl::Buffer());
+
+						kernel2.setArg(4, (standard)max_value);
+
+						kernel2.setArg(5, pixel_count);
+
+						scan_helpers.push_back(GetKernel(image_options, "get_B_S")); //get block sums of a starting c-hist
+
+						scan_helpers.back().setArg(0, buffer_CH);
+
+						scan_helpers.back().setArg(1, buffer_level_BS[0]);
+
+						scan_helpers.back().setArg(2, (int)local_elements_16);
+
+						scan_helper_global.push_back(cl::NDRange(level_blocks));
+						scan_helper_local.push_back(cl::NullRange);
+						continue;
+					}
+
+					cl::Kernel scan_blocks = GetKernel(image_options, scan_strategy == 2 ? "get_scan_blocks_RB" : "get_scan_blocks", level);
+
+					scan_blocks.setArg(0, level == 0 ? buffer_H : buffer_level_BS[level - 1]);
+
+					scan_blocks.setArg(1, level == 0 ? buffer_CH : buffer_level_BS[level - 1]);
+
+					scan_blocks.setArg(2, buffer_level_BS[level]);
+
+					scan_blocks.setArg(3, (standard)scan_level_elements[level]);
+
+					scan_blocks.setArg(4, cl::Local(local_size_16));
+
+					scan_blocks.setArg(5, cl::Local(local_size_16));
+
+					scan_blocks.setArg(6, single_level ? buffer_LUT : cl::Buffer());
+
+					scan_blocks.setArg(7, (standard)max_value);
+
+					scan_blocks.setArg(8, pixel_count);
+
+					if (level == 0)
+						kernel2 = scan_blocks;
+					else
+					{
+						scan_helpers.push_back(scan_blocks);
+						scan_helper_global.push_back(cl::NDRange(level_blocks * local_elements_16));
+						scan_helper_local.push_back(cl::NDRange(local_elements_16));
+					}
+				}
+
+				//down the levels: add the scanned block sums of the level above to every block but the first of a channel
+				for (unsigned int level = (unsigned int)scan_level_elements.size() - 1; level-- > 0; )
+				{
+					size_t level_blocks = channels * ((scan_level_elements[level] + scan_block_elements - 1) / scan_block_elements);
+
+					scan_helpers.push_back(GetKernel(image_options, "get_add_block_sums", level));
+
+					scan_helpers.back().setArg(0, level == 0 ? buffer_CH : buffer_level_BS[level - 1]);
+
+					scan_helpers.back().setArg(1, buffer_level_BS[level]);
+
+					scan_helpers.back().setArg(2, (standard)scan_level_elements[level]);
+
+					scan_helpers.back().setArg(3, (standard)scan_block_elements);
+
+					scan_helpers.back().setArg(4, level == 0 ? buffer_LUT : cl::Buffer());
+
+					scan_helpers.back().setArg(5, (standard)max_value);
+
+					scan_helpers.back().setArg(6, pixel_count);
+
+					scan_helper_global.push_back(cl::NDRange(level_blocks * local_elements_16));
+					scan_helper_local.push_back(cl::NDRange(local_elements_16));
+				}
+			}
+		}
+	}
+
+	//use the sort-based engine, the histogram and cumulative histogram are read off the sorted pixels
+	else if (mode_id == 3)
+	{
+		log << "Using sort-based histogram engine (" << radix_passes << " radix sort pass(es), " << radix_group_count << " workgroups)" << std::endl;
+
+		radix_counts = GetKernel(image_options, "get_radix_counts"); //get digit counts per workgroup
+		radix_scatter = GetKernel(image_options, "get_radix_scatter"); //stable scatter by digit
+
+		//digit offsets are scanned with the same kernels as the 16bit cumulative histogram
+		radix_scan = GetKernel(image_options, "get_chist_HS");
+		radix_scan_helper1 = GetKernel(image_options, "get_B_S");
+		radix_scan_helper2 = GetKernel(image_options, "get_scanned_BS_2");
+		radix_scan_helper3 = GetKernel(image_options, "get_complete_chist");
+
+		kernel2 = GetKernel(image_options, "get_chist_sorted"); //get a c-hist from the run boundaries
+		kernel2_helper1 = GetKernel(image_options, "get_hist_from_chist"); //get a hist from the c-hist
+
+		radix_counts.setArg(1, buffer_radix_counts);
+
+		radix_counts.setArg(2, (standard)input_image_elements);
+
+		radix_scan.setArg(0, buffer_radix_counts);
+
+		radix_scan.setArg(1, buffer_radix_offsets);
+
+		radix_scan.setArg(2, cl::Local(local_size_16));
+
+		radix_scan.setArg(3, cl::Local(local_size_16));
+
+		radix_scan.setArg(4, cl::Buffer()); //digit offsets have no LUT
+
+		radix_scan.setArg(5, (standard)0);
+
+		radix_scan.setArg(6, (standard)0);
+
+		radix_scan_helper1.setArg(0, buffer_radix_offsets);
+
+		radix_scan_helper1.setArg(1, buffer_radix_BS);
+
+		radix_scan_helper1.setArg(2, (int)local_elements_16);
+
+		radix_scan_helper2.setArg(0, buffer_radix_BS);
+
+		radix_scan_helper3.setArg(0, buffer_radix_BS);
+
+		radix_scan_helper3.setArg(1, buffer_radix_offsets);
+
+		radix_scatter.setArg(2, buffer_radix_counts);
+
+		radix_scatter.setArg(3, buffer_radix_offsets);
+
+		radix_scatter.setArg(4, (standard)input_image_elements);
+
+		radix_scatter.setArg(6, cl::Local(radix_local_elements * sizeof(unsigned short)));
+
+		radix_scatter.setArg(7, cl::Local(radix_local_elements * sizeof(standard)));
+
+		radix_scatter.setArg(8, cl::Local(radix_local_elements * sizeof(standard)));
+
+		//after an odd number of passes the sorted keys are in buffer_keys_A, otherwise in buffer_keys_B
+		kernel2.setArg(0, radix_passes % 2 ? buffer_keys_A : buffer_keys_B);
+
+		kernel2.setArg(1, buffer_CH);
+
+		kernel2.setArg(2, (standard)input_image_elements);
+
+		kernel2_helper1.setArg(0, buffer_CH);
+
+		kernel2_helper1.setArg(1, buffer_H);
+	}
+
+	//use basic version
+	else
+	{
+		log << "Using basic kernels" << std::endl;
+
+		//get a histogram with a specified number of bins
+		if (luminance)
+		{
+			log << "Using fused luminance histogram kernel" << std::endl;
+
+			kernel1 = GetKernel(image_options, bin_count == 256 ? "get_hist_Y8" : "get_hist_Y16");
+
+			if (bin_count == 256)
+			{
+				kernel1.setArg(2, cl::Local(local_size_8));
+
+				kernel1.setArg(3, (standard)plane_elements);
+			}
+			else
+				kernel1.setArg(2, (standard)plane_elements);
+		}
+		else if (colour)
+		{
+			kernel1 = GetKernel(image_options, bin_count == 256 ? "get_hist_8_C" : "get_hist_16_C");
+
+			kernel1.setArg(2, (standard)plane_elements);
+		}
+		else if (vectorised)
+		{
+			kernel1 = GetKernel(image_options, bin_count == 256 ? "get_hist_8_V" : "get_hist_16_V");
+			kernel1_tail = GetKernel(image_options, bin_count == 256 ? "get_hist_8" : "get_hist_16");
+			vectorised_hist = true;
+		}
+		else if (bin_count == 256)
+			kernel1 = GetKernel(image_options, "get_hist_8");
+		else if (subgroups)
+		{
+			log << "Using sub-group aggregated histogram kernel" << std::endl;
+
+			kernel1 = GetKernel(image_options, "get_hist_16_SG");
+			subgroup_hist = true;
+
+			kernel1.setArg(2, (standard)input_image_elements);
+		}
+		else
+			kernel1 = GetKernel(image_options, "get_hist_16");
+
+		kernel2 = GetKernel(image_options, "get_c_hist"); //get a c-hist
+
+		kernel2.setArg(2, bin_count);
+	}
+
+	log << "----------------------------------" << std::endl;
+
+	cl::Kernel kernel3 = GetKernel(image_options, "get_LUT"); //get a LUT froma normalised c-hist
+	cl::Kernel kernel4, kernel4_tail;
+
+	//get the output image using the lut
+	if (vectorised)
+	{
+		log << "Using vectorised kernels (" << vector_width << " pixels per work-item, tail of " << tail_elements << " element(s))" << std::endl;
+
+		if (local_LUT)
+		{
+			log << "Using LUT in local memory for the output (" << output_group_count << " workgroups)" << std::endl;
+
+			kernel4 = GetKernel(image_options, bin_count == 256 ? "get_Output8_LV" : "get_Output16_LV");
+
+			kernel4.setArg(3, cl::Local(output_LUT_size));
+
+			kernel4.setArg(4, (standard)vector_elements);
+		}
+		else if (constant_LUT)
+		{
+			log << "Using LUT in constant memory for the output (" << output_group_count << " workgroups)" << std::endl;
+
+			kernel4 = GetKernel(image_options, "get_Output16_CV");
+
+			kernel4.setArg(3, (standard)vector_elements);
+		}
+		else
+			kernel4 = GetKernel(image_options, bin_count == 256 ? "get_Output8_V" : "get_Output16_V");
+		kernel4_tail = GetKernel(image_options, bin_count == 256 ? "get_Output8" : "get_Output16");
+	}
+	else if (luminance)
+	{
+		kernel4 = GetKernel(image_options, bin_count == 256 ? "get_Output_Y8" : "get_Output_Y16");
+
+		kernel4.setArg(3, (standard)plane_elements);
+
+		if (bin_count != 256)
+			kernel4.setArg(4, (standard)max_value);
+	}
+	else if (colour)
+	{
+		kernel4 = GetKernel(image_options, bin_count == 256 ? "get_Output8_C" : "get_Output16_C");
+
+		kernel4.setArg(3, (standard)plane_elements);
+	}
+	else if (bin_count == 256)
+		kernel4 = GetKernel(image_options, "get_Output8");
+	else
+		kernel4 = GetKernel(image_options, "get_Output16");
+
+	//the sort-based engine has no histogram kernel and sets its own c-hist kernel arguments
+	if (mode_id != 3)
+	{
+		kernel1.setArg(0, buffer_input_image);
+
+		kernel1.setArg(1, buffer_H);
+
+		if (!fused_hist)
+		{
+			kernel2.setArg(0, buffer_H);
+
+			kernel2.setArg(1, buffer_CH);
+		}
+	}
+
+	kernel3.setArg(0, buffer_CH);
+
+	kernel3.setArg(1, buffer_LUT);
+
+	kernel3.setArg(2, max_value);
+
+	kernel3.setArg(3, (int)pixel_count);
+
+
+	kernel4.setArg(0, buffer_input_image);
+
+	kernel4.setArg(1, buffer_LUT);
+
+	kernel4.setArg(2, buffer_output_image);
+
+	if (vectorised_hist)
+	{
+		kernel1_tail.setArg(0, buffer_input_image);
+
+		kernel1_tail.setArg(1, buffer_H);
+	}
+
+	if (vectorised)
+	{
+		kernel4_tail.setArg(0, buffer_input_image);
+
+		kernel4_tail.setArg(1, buffer_LUT);
+
+		kernel4_tail.setArg(2, buffer_output_image);
+	}
+
+	cl::Event kernel1_tail_event, kernel4_tail_event;
+	std::vector<cl::Event> radix_events;
+	std::vector<cl::Event> scan_helper_events;
+	cl::Event kernel1_event, kernel2_event, kernel2_helper1_event, kernel3_event, kernel4_event, copy_event;
+
+	if (mode_id == 3)
+	{
+		//every radix sort kernel waits for the one before it
+		vector<cl::Event> radix_wait = hist_wait;
+
+		//stable passes over 4-bit digits, the keys ping-pong between the two key buffers
+		for (int pass = 0; pass < radix_passes; pass++)
+		{
+			cl::Buffer keys_in = pass == 0 ? buffer_input_image : (pass % 2 ? buffer_keys_A : buffer_keys_B);
+			cl::Buffer keys_out = pass % 2 ? buffer_keys_B : buffer_keys_A;
+
+			radix_counts.setArg(0, keys_in);
+
+			radix_counts.setArg(3, (standard)(pass * 4));
+
+			radix_scatter.setArg(0, keys_in);
+
+			radix_scatter.setArg(1, keys_out);
+
+			radix_scatter.setArg(5, (standard)(pass * 4));
+
+			radix_events.push_back(cl::Event());
+			queue.enqueueNDRangeKernel(radix_counts, cl::NullRange, cl::NDRange(radix_group_count * radix_local_elements), cl::NDRange(radix_local_elements), &radix_wait, &radix_events.back());
+			radix_wait.assign(1, radix_events.back());
+
+			radix_events.push_back(cl::Event());
+			queue.enqueueNDRangeKernel(radix_scan, cl::NullRange, cl::NDRange(radix_scan_elements), cl::NDRange(local_elements_16), &radix_wait, &radix_events.back());
+			radix_wait.assign(1, radix_events.back());
+
+			if (radix_scan_blocks > 1)
+			{
+				radix_events.push_back(cl::Event());
+				queue.enqueueNDRangeKernel(radix_scan_helper1, cl::NullRange, cl::NDRange(radix_scan_blocks), cl::NullRange, &radix_wait, &radix_events.back());
+				radix_wait.assign(1, radix_events.back());
+
+				radix_events.push_back(cl::Event());
+				queue.enqueueNDRangeKernel(radix_scan_helper2, cl::NullRange, cl::NDRange(radix_scan_blocks), cl::NDRange(radix_scan_blocks), &radix_wait, &radix_events.back());
+				radix_wait.assign(1, radix_events.back());
+
+				radix_events.push_back(cl::Event());
+				queue.enqueueNDRangeKernel(radix_scan_helper3, cl::NullRange, cl::NDRange(radix_scan_elements), cl::NDRange(local_elements_16), &radix_wait, &radix_events.back());
+				radix_wait.assign(1, radix_events.back());
+			}
+
+			radix_events.push_back(cl::Event());
+			queue.enqueueNDRangeKernel(radix_scatter, cl::NullRange, cl::NDRange(radix_group_count * radix_local_elements), cl::NDRange(radix_local_elements), &radix_wait, &radix_events.back());
+			radix_wait.assign(1, radix_events.back());
+		}
+
+		scan_wait.push_back(radix_events.back());
+	}
+	else if (luminance && bin_count == 256)
+		queue.enqueueNDRangeKernel(kernel1, cl::NullRange, cl::NDRange(kernel1_global_elements_Y), cl::NDRange(local_elements_8), &hist_wait, &kernel1_event);
+	else if (luminance)
+		queue.enqueueNDRangeKernel(kernel1, cl::NullRange, cl::NDRange(plane_elements), cl::NullRange, &hist_wait, &kernel1_event);
+	else if ((mode_id == 0 || mode_id == 1) && bin_count == 256 && pixels_per_item > 0)
+		queue.enqueueNDRangeKernel(kernel1, cl::NullRange, cl::NDRange(kernel1_global_elements_8_GS), cl::NDRange(local_elements_8), &hist_wait, &kernel1_event);
+	else if ((mode_id == 0 || mode_id == 1) && bin_count == 256 && vectorised_hist)
+		queue.enqueueNDRangeKernel(kernel1, cl::NullRange, cl::NDRange(kernel1_global_elements_8_V), cl::NDRange(local_elements_8), &hist_wait, &kernel1_event);
+	else if ((mode_id == 0 || mode_id == 1) && bin_count == 256)
+		queue.enqueueNDRangeKernel(kernel1, cl::NullRange, cl::NDRange(kernel1_global_elements_8), cl::NDRange(local_elements_8), &hist_wait, &kernel1_event);
+	else if (bin_count > 256 && subgroup_hist)
+		queue.enqueueNDRangeKernel(kernel1, cl::NullRange, cl::NDRange(kernel1_global_elements_8), cl::NDRange(local_elements_8), &hist_wait, &kernel1_event); //same padded launch as the 8bit local histogram
+	else if (mode_id == 0 || mode_id == 1)
+		queue.enqueueNDRangeKernel(kernel1, cl::NullRange, cl::NDRange(kernel1_global_elements_16), cl::NDRange(hist_local_elements_16), &hist_wait, &kernel1_event);
+	else if (vectorised_hist)
+		queue.enqueueNDRangeKernel(kernel1, cl::NullRange, cl::NDRange(vector_elements), cl::NullRange, &hist_wait, &kernel1_event);
+	else
+		queue.enqueueNDRangeKernel(kernel1, cl::NullRange, cl::NDRange(input_image_elements), cl::NullRange, &hist_wait, &kernel1_event);
+
+	//remaining tail pixels of the vectorised histogram
+	if (vectorised_hist && tail_elements)
+		queue.enqueueNDRangeKernel(kernel1_tail, cl::NDRange(tail_offset), cl::NDRange(tail_elements), cl::NullRange, &hist_wait, &kernel1_tail_event);
+
+	//the scan waits for the histogram and for the fills of the buffers it writes
+	if (mode_id != 3)
+		scan_wait.push_back(kernel1_event);
+	if (vectorised_hist && tail_elements)
+		scan_wait.push_back(kernel1_tail_event);
+
+	if ((mode_id == 0 || mode_id == 1) && single_group_scan)
+		queue.enqueueNDRangeKernel(kernel2, cl::NullRange, cl::NDRange(scan_local_elements * channels), cl::NDRange(scan_local_elements), &scan_wait, &kernel2_event);
+	else if (lookback_scan)
+		queue.enqueueNDRangeKernel(kernel2, cl::NullRange, cl::NDRange(kernel2_global_elements_16), cl::NDRange(local_elements_16), &scan_wait, &kernel2_event); //the whole c-hist in one launch
+	else if (block_sum_scan)
+	{
+		queue.enqueueNDRangeKernel(kernel2, cl::NullRange, cl::NDRange(group_count * channels * local_elements_16 / scan_items_per_block), cl::NDRange(local_elements_16 / scan_items_per_block), &scan_wait, &kernel2_event);
+
+		//the block sums of every channel are scanned separately, every level waits for the one before it
+		LUT_wait.assign(1, kernel2_event);
+
+		for (unsigned int i = 0; i < scan_helpers.size(); i++)
+		{
+			scan_helper_events.push_back(cl::Event());
+			queue.enqueueNDRangeKernel(scan_helpers[i], cl::NullRange, scan_helper_global[i], scan_helper_local[i], &LUT_wait, &scan_helper_events.back());
+			LUT_wait.assign(1, scan_helper_events.back());
+		}
+	}
+	else if (mode_id == 3)
+	{
+		queue.enqueueNDRangeKernel(kernel2, cl::NullRange, cl::NDRange(input_image_elements), cl::NullRange, &scan_wait, &kernel2_event);
+
+		LUT_wait.assign(1, kernel2_event);
+		queue.enqueueNDRangeKernel(kernel2_helper1, cl::NullRange, cl::NDRange(H_elements), cl::NullRange, &LUT_wait, &kernel2_helper1_event);
+		LUT_wait.assign(1, kernel2_helper1_event);
+	}
+	else if (fused_hist)
+	{
+		//the c-hist and the LUT come out of the fused histogram kernel
+		LUT_wait = scan_wait;
+	}
+	else if ((mode_id == 0 || mode_id == 1) && bin_count == 256)
+		queue.enqueueNDRangeKernel(kernel2, cl::NullRange, cl::NDRange(channels * scan_local_elements_8), cl::NDRange(scan_local_elements_8), &scan_wait, &kernel2_event);
+	else
+		queue.enqueueNDRangeKernel(kernel2, cl::NullRange, cl::NDRange(H_elements), cl::NullRange, &scan_wait, &kernel2_event);
+
+	//the scans with a single launch end with kernel2
+	if (LUT_wait.empty())
+		LUT_wait.assign(1, kernel2_event);
+
+	if (!scan_LUT)
+	{
+		queue.enqueueNDRangeKernel(kernel3, cl::NullRange, cl::NDRange(CH_elements), cl::NullRange, &LUT_wait, &kernel3_event);
+		output_wait.assign(1, kernel3_event);
+	}
+	else
+		output_wait = LUT_wait;
+
+	//with -cb a plain copy of the image into a scratch buffer gives the memory bandwidth the output kernel is measured against;
+	//the copy only needs the image, so it overlaps the histogram and scan stages, and the output kernel only waits for it
+	//when it overwrites the image the copy reads
+	if (copy_benchmark)
+	{
+		queue.enqueueCopyBuffer(buffer_input_image, buffer_copy_reference, 0, 0, input_image_size, &upload_events, &copy_event);
+		if (in_place)
+			output_wait.push_back(copy_event);
+	}
+
+	if (vectorised && (local_LUT || constant_LUT))
+	{
+		queue.enqueueNDRangeKernel(kernel4, cl::NullRange, cl::NDRange(output_group_count * local_elements_8), cl::NDRange(local_elements_8), &output_wait, &kernel4_event);
+
+		//remaining tail pixels of the vectorised output
+		if (tail_elements)
+			queue.enqueueNDRangeKernel(kernel4_tail, cl::NDRange(tail_offset), cl::NDRange(tail_elements), cl::NullRange, &output_wait, &kernel4_tail_event);
+	}
+	else if (vectorised)
+	{
+		queue.enqueueNDRangeKernel(kernel4, cl::NullRange, cl::NDRange(vector_elements), cl::NullRange, &output_wait, &kernel4_event);
+
+		//remaining tail pixels of the vectorised output
+		if (tail_elements)
+			queue.enqueueNDRangeKernel(kernel4_tail, cl::NDRange(tail_offset), cl::NDRange(tail_elements), cl::NullRange, &output_wait, &kernel4_tail_event);
+	}
+	else if (luminance)
+		queue.enqueueNDRangeKernel(kernel4, cl::NullRange, cl::NDRange(plane_elements), cl::NullRange, &output_wait, &kernel4_event);
+	else
+		queue.enqueueNDRangeKernel(kernel4, cl::NullRange, cl::NDRange(input_image_elements), cl::NullRange, &output_wait, &kernel4_event);
+
+	//the output and the histograms are read once the output kernel is complete
+	download_wait.assign(1, kernel4_event);
+	if (vectorised && tail_elements)
+		download_wait.push_back(kernel4_tail_event);
+
+	//in batch mode the output is read back on the download queue once the kernels are complete and the host returns
+	//straight away, the next image can then be uploaded while this one is equalised
+	if (slot)
+	{
+		queue.enqueueMarkerWithWaitList(NULL, &slot->compute_end);
+		last_compute_end = slot->compute_end;
+
+		download_wait.assign(1, slot->compute_end);
+		download_queue.enqueueReadBuffer(buffer_output_image, CL_FALSE, 0, input_image_size, output_data, &download_wait, &slot->download);
+
+		upload_queue.flush();
+		queue.flush();
+		download_queue.flush();
+		return;
+	}
+
+	//the histograms and the output are read without blocking, the host then waits once for all of the reads
+	vector<cl::Event> read_events;
+	vector<unsigned char> LUT_8; //the 8bit LUT is read as bytes and widened so it prints as numbers
+
+	if (print_histograms)
+	{
+		read_events.push_back(cl::Event());
+		queue.enqueueReadBuffer(buffer_H, CL_FALSE, 0, H_size, &H[0], &download_wait, &read_events.back());
+
+		read_events.push_back(cl::Event());
+		if (bin_count == 256)
+		{
+			LUT_8.resize(LUT.size());
+			queue.enqueueReadBuffer(buffer_LUT, CL_FALSE, 0, LUT_size, &LUT_8[0], &download_wait, &read_events.back());
+		}
+		else
+			queue.enqueueReadBuffer(buffer_LUT, CL_FALSE, 0, LUT_size, &LUT[0], &download_wait, &read_events.back());
+
+		if (keep_chist)
+		{
+			read_events.push_back(cl::Event());
+			queue.enqueueReadBuffer(buffer_CH, CL_FALSE, 0, CH_size, &CH[0], &download_wait, &read_events.back());
+		}
+		if (block_sum_scan)
+		{
+			read_events.push_back(cl::Event());
+			queue.enqueueReadBuffer(buffer_level_BS[0], CL_FALSE, 0, BS_size, &BS[0], &download_wait, &read_events.back());
+		}
+	}
+
+	cl::Event output_image_event, output_image_unmap_event;
+
+	//the output is read straight back into the output data of the caller, with zero-copy buffers it is already there
+	//and mapping the buffer only makes it visible to the host
+	if (zero_copy)
+	{
+		void* mapped_image = queue.enqueueMapBuffer(buffer_output_image, CL_FALSE, CL_MAP_READ, 0, input_image_size, &download_wait, &output_image_event);
+
+		vector<cl::Event> unmap_wait(1, output_image_event);
+		queue.enqueueUnmapMemObject(buffer_output_image, mapped_image, &unmap_wait, &output_image_unmap_event);
+		read_events.push_back(output_image_unmap_event);
+	}
+	else
+	{
+		queue.enqueueReadBuffer(buffer_output_image, CL_FALSE, 0, input_image_size, output_data, &download_wait, &output_image_event);
+		read_events.push_back(output_image_event);
+	}
+
+	//no other command follows the benchmarked copy when the output has its own buffer
+	if (copy_benchmark)
+		read_events.push_back(copy_event);
+
+	cl::Event::waitForEvents(read_events);
+
+	//print info to the console
+	if (print_histograms)
+	{
+		if (bin_count == 256)
+			LUT.assign(LUT_8.begin(), LUT_8.end());
+		log << "H = " << H << std::endl;
+		log << "----------------------------------" << std::endl;
+		if (keep_chist)
+		{
+			log << "CH = " << CH << std::endl;
+			log << "----------------------------" << std::endl;
+		}
+		if (block_sum_scan)
+		{
+			log << "BS = " << BS << std::endl;
+			log << "--------------------------------------" << std::endl;
+		}
+		log << "LUT = " << LUT << std::endl;
+		log << "-------------------------" << std::endl;
+	}
+
+	cl_ulong total_upload_time = input_image_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - input_image_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+	if (!fused_hist)
+		total_upload_time += H_input_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - H_input_event.getProfilingInfo<CL_PROFILING_COMMAND_START>()
+			+ LUT_input_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - LUT_input_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+	if (!fused_hist && chist_buffer)
+		total_upload_time += CH_input_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - CH_input_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+
+	//total upload time of input vectors
+	cl_ulong kernel1_time = 0;
+
+	//the sort-based engine times all radix sort kernels as its histogram stage
+	if (mode_id == 3)
+	{
+		for (unsigned int i = 0; i < radix_events.size(); i++)
+			kernel1_time += radix_events[i].getProfilingInfo<CL_PROFILING_COMMAND_END>() - radix_events[i].getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	}
+	else
+		kernel1_time = kernel1_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernel1_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+
+	//histogram kernel execution time
+	if (vectorised_hist && tail_elements)
+		kernel1_time += kernel1_tail_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernel1_tail_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+	cl_ulong kernel2_time = 0, kernel3_time = 0;
+
+	if (!fused_hist)
+		kernel2_time = kernel2_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernel2_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+	if (!scan_LUT)
+		kernel3_time = kernel3_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernel3_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+
+	//output kernel execution time, with the tail of the vectorised output
+	cl_ulong kernel4_time = kernel4_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernel4_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+	if (vectorised && tail_elements)
+		kernel4_time += kernel4_tail_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernel4_tail_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+	//c-hist kernel execution time
+	cl_ulong total_kernel_time = kernel1_time + kernel2_time + kernel3_time + kernel4_time;
+
+	cl_ulong copy_time = 0;
+
+	if (copy_benchmark)
+		copy_time = copy_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - copy_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+	cl_ulong output_image_download_time = output_image_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - output_image_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+	if (zero_copy)
+		output_image_download_time += output_image_unmap_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - output_image_unmap_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+	if (block_sum_scan)
+	{
+		cl_ulong kernel2_helper_time = 0; //c-hist extra kernel execution time
+
+		for (unsigned int i = 0; i < scan_helper_events.size(); i++)
+			kernel2_helper_time += scan_helper_events[i].getProfilingInfo<CL_PROFILING_COMMAND_END>() - scan_helper_events[i].getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+		kernel2_time += kernel2_helper_time;
+
+		//adds the helper kernel execution time so that the entire execution time is taken into account
+		total_kernel_time += kernel2_helper_time;
+	}
+	else if (lookback_scan)
+		total_upload_time += (LB_status_input_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - LB_status_input_event.getProfilingInfo<CL_PROFILING_COMMAND_START>());
+	else if (mode_id == 3)
+	{
+		cl_ulong kernel2_helper_time = kernel2_helper1_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernel2_helper1_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+		kernel2_time += kernel2_helper_time;
+
+		total_kernel_time += kernel2_helper_time;
+	}
+
+	//execution times in microseconds, so total time is divided by 1000
+	log << " Memory transfer time: " << total_upload_time / 1000 << "ms" << std::endl;
+	log << " ---------------------------------------------------------" << std::endl;
+	log << " Kernel execution time: " << total_kernel_time / 1000 << "ms" << std::endl;
+	log << " ---------------------------------------------------------" << std::endl;
+	if (fused_hist)
+		log << " Fused histogram, cumulative histogram and LUT kernel execution time: " << kernel1_time / 1000 << "ms" << std::endl;
+	else
+		log << " Histogram kernel execution time: " << kernel1_time / 1000 << "ms" << std::endl;
+	log << " ---------------------------------------------------------" << std::endl;
+	//the fused kernel time already covers the cumulative histogram,
+	//otherwise the scan strategy is named next to the time where the optimised per-block scan is used
+	if (!fused_hist)
+	{
+		if ((mode_id == 0 || mode_id == 1) && !single_group_scan)
+			log << " Cumulative histogram kernel execution time (" << scan_name << " scan): " << kernel2_time / 1000 << "ms" << std::endl;
+		else
+			log << " Cumulative histogram kernel execution time: " << kernel2_time / 1000 << "ms" << std::endl;
+		log << " ---------------------------------------------------------" << std::endl;
+	}
+	//the output kernel and the copy both read and write every byte of the image once, bytes per ns are GB/s
+	log << " Output kernel execution time: " << kernel4_time / 1000 << "ms (" << 2.0 * input_image_size / std::max(kernel4_time, (cl_ulong)1) << " GB/s";
+	if (copy_benchmark)
+		log << ", buffer copy " << 2.0 * input_image_size / std::max(copy_time, (cl_ulong)1) << " GB/s";
+	log << ")" << std::endl;
+	log << " ---------------------------------------------------------" << std::endl;
+	log << " Program execution time: " << (total_upload_time + total_kernel_time + output_image_download_time) / 1000 << "ms" << std::endl;
+	log << " ---------------------------------------------------------" << std::endl;
+
+	//the critical path runs from the first command of the image to the end of the output read, it is shorter than the sum
+	//of the stage times above where the queue overlaps commands
+	cl_ulong first_start = input_image_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+	if (!fused_hist)
+		first_start = std::min(first_start, std::min(H_input_event.getProfilingInfo<CL_PROFILING_COMMAND_START>(), LUT_input_event.getProfilingInfo<CL_PROFILING_COMMAND_START>()));
+	if (!fused_hist && chist_buffer)
+		first_start = std::min(first_start, CH_input_event.getProfilingInfo<CL_PROFILING_COMMAND_START>());
+	if (lookback_scan)
+		first_start = std::min(first_start, LB_status_input_event.getProfilingInfo<CL_PROFILING_COMMAND_START>());
+
+	cl_ulong last_end = (zero_copy ? output_image_unmap_event : output_image_event).getProfilingInfo<CL_PROFILING_COMMAND_END>();
+	cl_ulong critical_path_time = last_end - first_start;
+
+	log << " Critical path time: " << critical_path_time / 1000 << "ms (sum of stage times " << (total_upload_time + total_kernel_time + copy_time + output_image_download_time) / 1000 << "ms)" << std::endl;
+}
+
+//decoded image of a batch, images with a maxval up to 255 are kept as bytes so they are equalised with the 8bit kernels
+struct BatchImage
+{
+	cimg_library::CImg<unsigned char> image_8;
+	cimg_library::CImg<unsigned short> image_16;
+	int max_value = 0;
+	string output_file;
+};
+
+static std::shared_ptr<BatchImage> DecodeBatchImage(const string& input_file, const string& output_file)
+{
+	std::shared_ptr<BatchImage> image = std::make_shared<BatchImage>();
+	cimg_library::CImg<unsigned short> decoded(input_file.c_str());
+
+	//the maxval of the header decides the bit depth, the image data decides if the header cannot be read
+	image->max_value = GetPNMMaxval(input_file);
+	if (image->max_value <= 0)
+		image->max_value = decoded.max() <= 255 ? 255 : 65535;
+
+	if (image->max_value <= 255)
+		image->image_8.assign(decoded);
+	else
+		image->image_16.swap(decoded);
+	image->output_file = output_file;
+
+	return image;
+}
+
+void HistogramEqualizer::EqualizeFiles(const std::vector<string>& input_files, const std::vector<string>& output_files)
+{
+	const int slot_count = 3; //the images being uploaded, equalised and downloaded
+	const size_t lookahead = 4; //images decoded ahead of the device and encodes pending behind it
+
+	if (!upload_queue())
+	{
+		upload_queue = CreateQueue(CL_QUEUE_PROFILING_ENABLE);
+		download_queue = CreateQueue(CL_QUEUE_PROFILING_ENABLE);
+	}
+
+	BatchSlot slots[slot_count];
+	vector<BatchSlot> history; //events of every equalised image
+	std::deque<std::future<std::shared_ptr<BatchImage> > > decodes;
+	std::deque<std::pair<string, std::future<void> > > encodes; //output file and encode of the images behind the device
+	size_t next_decode = 0;
+	int failed = 0;
+	double decode_wait_time = 0.0; //time the device could not be fed because the next image was still being decoded
+
+	//a failed decode, equalisation or encode only loses its own image, called from the handler of the exception
+	auto report_failure = [&](const string& file_name)
+	{
+		failed++;
+		try
+		{
+			throw;
+		}
+		catch (const cl::Error& e)
+		{
+			log_stream << file_name << ": OpenCL - ERROR: " << e.what() << ", " << getErrorString(e.err()) << std::endl;
+		}
+		catch (cimg_library::CImgException& e)
+		{
+			log_stream << file_name << ": CImg - ERROR: " << e.what() << std::endl;
+		}
+		catch (const std::exception& e)
+		{
+			log_stream << file_name << ": ERROR: " << e.what() << std::endl;
+		}
+	};
+
+	auto finish_encode = [&]()
+	{
+		try
+		{
+			encodes.front().second.get();
+		}
+		catch (...)
+		{
+			report_failure(encodes.front().first);
+		}
+		encodes.pop_front();
+	};
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < input_files.size(); i++)
+	{
+		//host threads decode the next images while the device works on the current ones
+		for (; next_decode < input_files.size() && next_decode < i + lookahead; next_decode++)
+			decodes.push_back(std::async(std::launch::async, DecodeBatchImage, input_files[next_decode], output_files[next_decode]));
+
+		std::shared_ptr<BatchImage> image;
+		std::chrono::steady_clock::time_point decode_wait_start = std::chrono::steady_clock::now();
+		try
+		{
+			image = decodes.front().get();
+		}
+		catch (...)
+		{
+			report_failure(input_files[i]);
+		}
+		decodes.pop_front();
+		decode_wait_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - decode_wait_start).count();
+
+		if (!image)
+			continue;
+
+		BatchSlot& slot = slots[i % slot_count];
+		slot.index = i % slot_count;
+		slot.verbose = history.empty();
+
+		try
+		{
+			if (image->max_value <= 255)
+				Run(image->image_8.data(), 1, image->image_8.width(), image->image_8.height() * image->image_8.depth(), image->image_8.spectrum(), image->max_value, false, &slot);
+			else
+				Run(image->image_16.data(), 2, image->image_16.width(), image->image_16.height() * image->image_16.depth(), image->image_16.spectrum(), image->max_value, false, &slot);
+		}
+		catch (...)
+		{
+			report_failure(input_files[i]);
+
+			//commands enqueued before the failure may still read the image data, which is released with the image
+			upload_queue.finish();
+			queue.finish();
+			continue;
+		}
+
+		history.push_back(slot);
+
+		//a host thread writes the result once its download is complete, the image is kept alive by the thread
+		encodes.push_back(std::make_pair(image->output_file, std::async(std::launch::async, [image](cl::Event download)
+		{
+			download.wait();
+			if (image->max_value <= 255)
+				image->image_8.save(image->output_file.c_str());
+			else
+				image->image_16.save(image->output_file.c_str());
+		}, slot.download)));
+
+		//older encodes are finished first so that only a bounded number of images is held in memory
+		while (encodes.size() > lookahead)
+			finish_encode();
+	}
+
+	while (!encodes.empty())
+		finish_encode();
+
+	double total_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	log_stream << "Batch of " << history.size() << " image(s) equalised in " << total_time << "s (" << history.size() / std::max(total_time, 1e-9) << " images/s)";
+	if (failed)
+		log_stream << ", " << failed << " image(s) failed";
+	log_stream << std::endl;
+
+	if (history.empty())
+		return;
+
+	//busy time of every stage over the device time from the first upload to the last download,
+	//the compute stage of an image lasts from its barrier to its marker on the compute queue
+	cl_ulong upload_time = 0, compute_time = 0, download_time = 0;
+	cl_ulong first_start = history.front().upload.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	cl_ulong last_end = 0;
+
+	for (unsigned int i = 0; i < history.size(); i++)
+	{
+		upload_time += history[i].upload.getProfilingInfo<CL_PROFILING_COMMAND_END>() - history[i].upload.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		compute_time += history[i].compute_end.getProfilingInfo<CL_PROFILING_COMMAND_END>() - history[i].compute_start.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		download_time += history[i].download.getProfilingInfo<CL_PROFILING_COMMAND_END>() - history[i].download.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		last_end = std::max(last_end, history[i].download.getProfilingInfo<CL_PROFILING_COMMAND_END>());
+	}
+
+	double span = (double)std::max(last_end - first_start, (cl_ulong)1);
+
+	//times in nanoseconds, so the span is divided by 1000000 for milliseconds
+	log_stream << " Device time: " << span / 1000000 << "ms" << std::endl;
+	log_stream << " ---------------------------------------------------------" << std::endl;
+	log_stream << " Upload idle: " << 100.0 * (1.0 - upload_time / span) << "%" << std::endl;
+	log_stream << " Compute idle: " << 100.0 * (1.0 - compute_time / span) << "%" << std::endl;
+	log_stream << " Download idle: " << 100.0 * (1.0 - download_time / span) << "%" << std::endl;
+	log_stream << " Host waiting on decode: " << 100.0 * decode_wait_time / std::max(total_time, 1e-9) << "% of the batch time" << std::endl;
+}
+
+void HistogramEqualizer::EqualizeStreamed(const string& input_file, const string& output_file, size_t memory_budget)
+{
+	int width, height, channels, max_value;
+	size_t payload_offset = 0;
+	char magic[2] = { 0, 0 };
+
+	ifstream input(input_file, ios::binary);
+	input.read(magic, 2);
+
+	if (!GetPNMHeader(input_file, width, height, channels, max_value, &payload_offset) || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6'))
+		throw std::runtime_error("Streaming needs a binary PGM/PPM file (P5/P6): " + input_file);
+
+	size_t pixel_size = max_value <= 255 ? 1 : 2;
+	size_t image_elements = (size_t)width * height * channels;
+	max_value = std::min(max_value, 65535);
+
+	//the histogram bins and the LUT normalisation count in 32 bits
+	if (image_elements > std::numeric_limits<cl_uint>::max())
+		throw std::runtime_error("Streaming supports images of up to 2^32 - 1 samples: " + input_file);
+
+	int bin_count = pixel_size == 1 ? 256 : 512;
+	while (bin_count <= max_value)
+		bin_count *= 2;
+
+	//the payload is streamed as stored in the file, with a shared histogram the channel order does not matter
+	bool swap_bytes = pixel_size == 2 && device_little_endian;
+	string image_options = "-D BIN_COUNT=" + std::to_string(bin_count) + (swap_bytes ? " -D SWAP_BYTES" : "");
+
+	if (options.colour || options.luminance)
+		log_stream << "Streaming equalises all channels with a shared histogram, -c and -y are ignored" << std::endl;
+
+	//two device tiles (one is transferred while the other is processed), the histogram and the LUT share the budget;
+	//a tile is a whole number of 256 sample groups and never larger than the largest allocation of the device
+	size_t H_size = bin_count * sizeof(cl_uint);
+	size_t LUT_size = bin_count * pixel_size;
+	size_t tile_granularity = 256 * pixel_size;
+	size_t tile_size = memory_budget > H_size + LUT_size ? (memory_budget - H_size - LUT_size) / 2 : 0;
+
+	tile_size = std::min(tile_size, (size_t)device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>());
+	tile_size = std::min(tile_size / tile_granularity, (image_elements * pixel_size + tile_granularity - 1) / tile_granularity) * tile_granularity;
+
+	if (tile_size == 0)
+		throw std::runtime_error("The memory budget is too small for the histogram and two tiles");
+
+	size_t tile_elements = tile_size / pixel_size;
+	size_t tile_count = (image_elements + tile_elements - 1) / tile_elements;
+
+	log_stream << "Image maxval " << max_value << ", " << bin_count << " bins, streamed in " << tile_count << " tile(s) of " << tile_size / 1024 << "KB" << std::endl;
+
+	// device and host buffers, the host keeps two tiles as well
+	cl::Buffer buffer_tiles[2] = { GetBuffer("tile_0", tile_size), GetBuffer("tile_1", tile_size) };
+	cl::Buffer buffer_H = GetBuffer("H", H_size);
+	cl::Buffer buffer_LUT = GetBuffer("LUT", LUT_size);
+	std::unique_ptr<HostMemory> host_tiles[2] = { std::unique_ptr<HostMemory>(new HostMemory(tile_size)), std::unique_ptr<HostMemory>(new HostMemory(tile_size)) };
+
+	//histogram kernels that accumulate into H over any number of launches: the local memory histogram for 8bit tiles,
+	//the privatized grid-stride histogram for 16bit tiles
+	cl::Kernel hist_kernel;
+	size_t hist_local_elements = 256, hist_group_count = 0;
+
+	if (bin_count == 256)
+	{
+		hist_kernel = GetKernel(image_options, "get_hist_8LC");
+
+		hist_kernel.setArg(2, cl::Local(256 * sizeof(cl_uint)));
+	}
+	else
+	{
+		hist_kernel = GetKernel(image_options, "get_hist_16LC");
+
+		size_t bins_per_pass = GetBinsPerPass(device, hist_kernel, bin_count);
+
+		hist_local_elements = std::min((size_t)256, hist_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+		hist_group_count = std::min((size_t)device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * 4, (tile_elements + hist_local_elements - 1) / hist_local_elements);
+
+		hist_kernel.setArg(2, cl::Local(bins_per_pass * sizeof(cl_uint)));
+
+		hist_kernel.setArg(4, (cl_uint)bins_per_pass);
+
+		hist_kernel.setArg(6, (cl_uint)bin_count);
+	}
+
+	hist_kernel.setArg(1, buffer_H);
+
+	//the single workgroup scan writes the LUT from H in one launch, the c-hist is not stored;
+	//its two local arrays of one value per work-item have to fit in the local memory
+	size_t scan_local_elements = 1;
+	cl::Kernel scan_kernel = GetKernel(image_options, "get_chist_BC");
+	size_t max_scan_local_elements = std::min(scan_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+		(size_t)(device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() / (2 * sizeof(cl_uint))));
+	while (scan_local_elements * 2 <= std::min((size_t)bin_count, max_scan_local_elements))
+		scan_local_elements *= 2;
+
+	scan_kernel.setArg(0, buffer_H);
+
+	scan_kernel.setArg(1, cl::Buffer());
+
+	scan_kernel.setArg(2, cl::Local(scan_local_elements * sizeof(cl_uint)));
+
+	scan_kernel.setArg(3, cl::Local(scan_local_elements * sizeof(cl_uint)));
+
+	scan_kernel.setArg(4, buffer_LUT);
+
+	scan_kernel.setArg(5, (cl_uint)max_value);
+
+	scan_kernel.setArg(6, (cl_uint)image_elements);
+
+	cl::Kernel output_kernel = GetKernel(image_options, bin_count == 256 ? "get_Output8" : "get_Output16");
+
+	output_kernel.setArg(1, buffer_LUT);
+
+	//every tile waits for the transfers and kernels of the tile before it in the same buffers, so a tile is read from the
+	//file and uploaded while the other one is processed; the host only blocks before it refills a host tile
+	vector<cl::Event> upload_events, kernel_events, download_events;
+	cl::Event last_upload[2], last_kernel[2], last_download[2], H_fill_event, scan_event;
+	double file_time = 0.0; //host time spent reading and writing the file
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// pass 1 - histogram of every tile
+	queue.enqueueFillBuffer(buffer_H, 0, 0, H_size, NULL, &H_fill_event);
+	input.seekg(payload_offset);
+
+	vector<cl::Event> scan_wait;
+
+	for (size_t tile = 0; tile < tile_count; tile++)
+	{
+		int b = tile % 2;
+		size_t elements = std::min(tile_elements, image_elements - tile * tile_elements);
+
+		if (last_upload[b]())
+			last_upload[b].wait();
+
+		std::chrono::steady_clock::time_point read_start = std::chrono::steady_clock::now();
+		if (!input.read((char*)host_tiles[b]->data(), elements * pixel_size))
+			throw std::runtime_error("Cannot read " + input_file);
+		file_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - read_start).count();
+
+		vector<cl::Event> upload_wait;
+		if (last_kernel[b]())
+			upload_wait.push_back(last_kernel[b]);
+
+		queue.enqueueWriteBuffer(buffer_tiles[b], CL_FALSE, 0, elements * pixel_size, host_tiles[b]->data(), upload_wait.empty() ? NULL : &upload_wait, &last_upload[b]);
+
+		hist_kernel.setArg(0, buffer_tiles[b]);
+
+		hist_kernel.setArg(3, (cl_uint)elements);
+
+		if (bin_count != 256)
+			hist_kernel.setArg(5, (cl_uint)elements);
+
+		vector<cl::Event> hist_wait = { last_upload[b], H_fill_event };
+		if (bin_count == 256)
+			queue.enqueueNDRangeKernel(hist_kernel, cl::NullRange, cl::NDRange((elements + 255) / 256 * 256), cl::NDRange(256), &hist_wait, &last_kernel[b]);
+		else
+			queue.enqueueNDRangeKernel(hist_kernel, cl::NullRange, cl::NDRange(hist_group_count * hist_local_elements), cl::NDRange(hist_local_elements), &hist_wait, &last_kernel[b]);
+
+		queue.flush();
+
+		upload_events.push_back(last_upload[b]);
+		kernel_events.push_back(last_kernel[b]);
+		scan_wait.push_back(last_kernel[b]);
+	}
+
+	// the LUT is computed once from the histogram of the whole image
+	queue.enqueueNDRangeKernel(scan_kernel, cl::NullRange, cl::NDRange(scan_local_elements), cl::NDRange(scan_local_elements), &scan_wait, &scan_event);
+
+	//the last uploads and histograms of pass 1 still use both host and device tiles, the scan follows all of them
+	scan_event.wait();
+
+	std::chrono::steady_clock::time_point histogram_end = std::chrono::steady_clock::now();
+
+	// pass 2 - output of every tile, written to the file in order behind the device
+	vector<char> header(payload_offset);
+	input.clear();
+	input.seekg(0);
+	input.read(&header[0], payload_offset);
+
+	ofstream output(output_file, ios::binary);
+	output.write(&header[0], payload_offset);
+
+	size_t pending_size[2] = { 0, 0 }; //bytes of a downloaded tile that still have to be written
+
+	for (size_t tile = 0; tile < tile_count + 2; tile++)
+	{
+		int b = tile % 2;
+
+		//the host tile holds the tile two steps back until it is written out
+		if (pending_size[b])
+		{
+			last_download[b].wait();
+
+			std::chrono::steady_clock::time_point write_start = std::chrono::steady_clock::now();
+			output.write((const char*)host_tiles[b]->data(), pending_size[b]);
+			file_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - write_start).count();
+
+			pending_size[b] = 0;
+		}
+
+		//the last two steps only write out the remaining tiles
+		if (tile >= tile_count)
+			continue;
+
+		size_t elements = std::min(tile_elements, image_elements - tile * tile_elements);
+
+		std::chrono::steady_clock::time_point read_start = std::chrono::steady_clock::now();
+		if (!input.read((char*)host_tiles[b]->data(), elements * pixel_size))
+			throw std::runtime_error("Cannot read " + input_file);
+		file_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - read_start).count();
+
+		//the device tile was last read by the download of the tile two steps back (complete) or, for the first two tiles,
+		//by a histogram kernel of pass 1
+		vector<cl::Event> upload_wait(1, last_kernel[b]);
+		queue.enqueueWriteBuffer(buffer_tiles[b], CL_FALSE, 0, elements * pixel_size, host_tiles[b]->data(), last_kernel[b]() ? &upload_wait : NULL, &last_upload[b]);
+
+		output_kernel.setArg(0, buffer_tiles[b]);
+
+		output_kernel.setArg(2, buffer_tiles[b]);
+
+		vector<cl::Event> output_wait = { last_upload[b], scan_event };
+		queue.enqueueNDRangeKernel(output_kernel, cl::NullRange, cl::NDRange(elements), cl::NullRange, &output_wait, &last_kernel[b]);
+
+		vector<cl::Event> download_wait(1, last_kernel[b]);
+		queue.enqueueReadBuffer(buffer_tiles[b], CL_FALSE, 0, elements * pixel_size, host_tiles[b]->data(), &download_wait, &last_download[b]);
+
+		queue.flush();
+
+		pending_size[b] = elements * pixel_size;
+		upload_events.push_back(last_upload[b]);
+		kernel_events.push_back(last_kernel[b]);
+		download_events.push_back(last_download[b]);
+	}
+
+	if (!output)
+		throw std::runtime_error("Cannot write " + output_file);
+
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+	cl_ulong upload_time = 0, kernel_time = 0, download_time = 0;
+
+	for (unsigned int i = 0; i < upload_events.size(); i++)
+		upload_time += upload_events[i].getProfilingInfo<CL_PROFILING_COMMAND_END>() - upload_events[i].getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	for (unsigned int i = 0; i < kernel_events.size(); i++)
+		kernel_time += kernel_events[i].getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernel_events[i].getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	for (unsigned int i = 0; i < download_events.size(); i++)
+		download_time += download_events[i].getProfilingInfo<CL_PROFILING_COMMAND_END>() - download_events[i].getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+	kernel_time += scan_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - scan_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+	double total_time = std::chrono::duration<double>(end - start).count();
+	double image_MB = image_elements * pixel_size / 1048576.0;
+
+	//device times in nanoseconds, so they are divided by 1000000 for milliseconds
+	log_stream << " Histogram pass: " << std::chrono::duration<double>(histogram_end - start).count() * 1000 << "ms" << std::endl;
+	log_stream << " Output pass: " << std::chrono::duration<double>(end - histogram_end).count() * 1000 << "ms" << std::endl;
+	log_stream << " ---------------------------------------------------------" << std::endl;
+	log_stream << " File read and write time: " << file_time * 1000 << "ms" << std::endl;
+	log_stream << " Memory transfer time: " << (upload_time + download_time) / 1000000 << "ms" << std::endl;
+	log_stream << " Kernel execution time: " << kernel_time / 1000000 << "ms" << std::endl;
+	log_stream << " ---------------------------------------------------------" << std::endl;
+	log_stream << " Total time: " << total_time * 1000 << "ms (" << 2 * image_MB / std::max(total_time, 1e-9) << " MB/s streamed over both passes)" << std::endl;
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Utils.h"
+#include "CImg.h"
+
+//reads the size, channel count and maxval of a PNM header (P1 to P6), comments between the fields are skipped
+//bitmaps (P1/P4) report 255, the maxval of their decoded pixels, returns false if the header cannot be read
+//payload_offset receives the offset of the pixel data of the binary formats
+bool GetPNMHeader(const string& file_name, int& width, int& height, int& channels, int& max_value, size_t* payload_offset = NULL);
+
+//reads the maxval field of a PNM header, returns 255 for bitmaps (P1/P4) and 0 if the header cannot be read
+int GetPNMMaxval(const string& file_name);
+
+//page-aligned host memory for image data, the engine works on it without copying on devices with unified host memory
+class HostMemory
+{
+public:
+	static const size_t alignment = 4096;
+
+	explicit HostMemory(size_t size);
+	~HostMemory();
+
+	void* data() const { return pointer; }
+
+private:
+	HostMemory(const HostMemory&) = delete;
+	HostMemory& operator=(const HostMemory&) = delete;
+
+	void* pointer;
+};
+
+//whole file mapped into memory, written pages are private copies so mapped image data can be equalised in place
+//without changing the file
+class MappedFile
+{
+public:
+	explicit MappedFile(const string& file_name);
+	~MappedFile();
+
+	unsigned char* data() const { return pointer; }
+	size_t size() const { return file_size; }
+
+private:
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	void Close();
+
+	unsigned char* pointer;
+	size_t file_size;
+#ifdef _WIN32
+	void* file_handle;
+	void* mapping_handle;
+#else
+	int file_descriptor;
+#endif
+};
+
+//histogram equalisation engine for one OpenCL device
+//the context, queue, built programs, kernels and buffers are kept between images, so only the first image of a bit depth
+//pays for the program build and buffers are only reallocated when an image needs more memory than any image before it
+class HistogramEqualizer
+{
+public:
+	//the run options, the command line of Tutorial 2 maps onto these one to one
+	struct Options
+	{
+		int mode_id = 0; //0 and 1 optimised kernels, 2 basic kernels, 3 sort-based engine
+		int pixels_per_item = 0; //coarsened (grid-stride) histogram kernels
+		bool vectorised = false;
+		bool subgroups = false;
+		int replicas = 1; //replicated local sub-histograms for 8-bit images
+		bool colour = false; //a histogram and LUT per colour channel
+		bool luminance = false; //equalise the Y of YCbCr only
+		int scan_strategy = 0; //0 Hillis-Steele/collective, 1 Blelloch, 2 register-blocked
+		int scan_strip = 8; //bins per work-item of the register-blocked scan
+		bool keep_chist = false; //store and print the cumulative histogram
+		bool in_place = true; //write the output over the input buffer on the device
+		bool copy_benchmark = false; //time a plain device copy of the image next to the output kernel
+		bool print_histograms = true; //read back and print H, CH and the LUT after every image
+		bool zero_copy = true; //on devices with unified host memory the device works on the image data of the caller in place
+		string program_cache = "kernels/cache"; //directory of the built program binaries, empty to always build from source
+	};
+
+	//selects the device and loads the kernel source, log receives the kernel choices, histograms and timings
+	HistogramEqualizer(int platform_id, int device_id, const Options& options, std::ostream& log = std::cout);
+
+	//equalises a copy of the image, max_value is the maxval of the image (0 takes the largest pixel value)
+	template <typename T>
+	cimg_library::CImg<T> equalize(const cimg_library::CImg<T>& image, int max_value = 0)
+	{
+		cimg_library::CImg<T> output(image.width(), image.height(), image.depth(), image.spectrum());
+		equalize(image.data(), output.data(), image.width(), image.height() * image.depth(), image.spectrum(), max_value);
+		return output;
+	}
+
+	//equalises planar image data (channels planes of width * height pixels) in place
+	//unsigned char data is equalised with 256 bins, unsigned short data with the maxval rounded up to a power of two
+	template <typename T>
+	void equalize(T* data, int width, int height, int channels, int max_value = 0)
+	{
+		equalize(data, data, width, height, channels, max_value);
+	}
+
+	//equalises planar image data into output, the input is kept with the -o option (in_place off)
+	//on devices with unified host memory both are used by the device without a copy, they should then be in HostMemory
+	template <typename T>
+	void equalize(const T* input, T* output, int width, int height, int channels, int max_value = 0)
+	{
+		static_assert(sizeof(T) == 1 || sizeof(T) == 2, "only 8-bit and 16-bit images are supported");
+
+		if (max_value <= 0)
+		{
+			size_t elements = (size_t)width * height * channels;
+			for (size_t i = 0; i < elements; i++)
+				max_value = std::max(max_value, (int)input[i]);
+		}
+
+		Run(const_cast<T*>(input), sizeof(T), width, height, channels, max_value, false, NULL, output);
+	}
+
+	//equalises the pixel data of a binary PNM (P5/P6) in place as it is stored in the file, with interleaved channels and
+	//big-endian 16bit samples; the kernels index the channels and swap the bytes so the data is uploaded without conversion
+	void equalizePNMPayload(void* payload, int width, int height, int channels, int max_value)
+	{
+		Run(payload, max_value <= 255 ? 1 : 2, width, height, channels, max_value, true);
+	}
+
+	//equalises every input file into the output file of the same index
+	//host threads decode and encode the images while the device uploads image N+1, equalises image N and downloads image N-1,
+	//the images per second and the idle fraction of the upload, compute and download stages are reported at the end
+	void EqualizeFiles(const std::vector<string>& input_files, const std::vector<string>& output_files);
+
+	//equalises a binary PNM (P5/P6) file into output_file without holding the image in host or device memory
+	//the payload is streamed twice in tiles sized from memory_budget (bytes of device memory for two tiles, the
+	//histogram and the LUT): once through the histogram kernel, then, after a single scan, through the output kernel
+	void EqualizeStreamed(const string& input_file, const string& output_file, size_t memory_budget);
+
+	const Options& GetOptions() const { return options; }
+
+	//true if image data is used by the device without a copy, the input and output data should then be in HostMemory
+	bool IsZeroCopy() const { return zero_copy_supported && options.zero_copy; }
+
+private:
+	//buffers and events of one image in flight in batch mode, the slots are used in turn
+	struct BatchSlot
+	{
+		int index = 0;
+		bool verbose = false; //log the kernel choices of the image
+		cl::Event upload, compute_start, compute_end, download;
+	};
+
+	//equalises one image whose pixels are pixel_size bytes wide
+	//with a slot the transfers and kernels are only enqueued and the slot receives their events, the data must then be
+	//kept until the download event of the slot is complete
+	//pnm_payload tells that the data is the payload of a binary PNM file instead of planar CImg data
+	//output receives the equalised image, it is written over data when output is NULL; data is only read when in_place is off
+	//and output is another buffer
+	void Run(void* data, size_t pixel_size, int width, int height, int spectrum, int max_value, bool pnm_payload, BatchSlot* slot = NULL, void* output = NULL);
+
+	//program built with the image dependent build options (bin count and data layout), built on first use
+	//or loaded from the binary cache of an earlier run
+	cl::Program& GetProgram(const string& image_options);
+
+	//kernel of the program of the image options, instance tells apart kernels that are launched more than once with different arguments
+	cl::Kernel GetKernel(const string& image_options, const string& name, int instance = 0);
+
+	//true if the program of the image options has the kernel, kernels behind an #if of the device compiler may be missing
+	bool HasKernel(const string& image_options, const string& name);
+
+	//queue on the device of the engine, created through the OpenCL 1.2 entry point on 1.x platforms
+	cl::CommandQueue CreateQueue(cl_command_queue_properties properties);
+
+	//grow-only buffer, reallocated only when size is larger than the buffer
+	cl::Buffer GetBuffer(const string& name, size_t size);
+
+	Options options;
+	std::ostream& log_stream;
+	std::ostream null_log; //discards the output of the quiet images of a batch
+
+	cl::Context context;
+	cl::Device device;
+	cl::CommandQueue queue;
+	cl::CommandQueue upload_queue, download_queue; //created by the first batch
+	cl::Event last_compute_end; //the kernels of the last image of a batch, the next image shares their buffers
+	cl::Program::Sources sources;
+
+	string build_options; //device dependent part of the build options, the bin count is added per program
+	string collective_scan_name; //collective scan used by the workgroup scans, empty for the Hillis-Steele scan
+	bool subgroups_supported = false;
+	bool zero_copy_supported = false; //the device shares the host memory
+	bool device_little_endian = true;
+
+	std::map<string, cl::Program> programs;
+	std::map<string, cl::Kernel> kernels;
+	std::map<string, std::pair<cl::Buffer, size_t> > buffers;
+
+	//accumulated histogram and completion counter of the fused kernel, zeroed once when they are created
+	cl::Buffer buffer_H_sum, buffer_counter;
+};
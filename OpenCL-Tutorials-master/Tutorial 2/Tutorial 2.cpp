@@ -10,19 +10,32 @@ an exclusive scan, an exclusive scan using Blelloch, a complete histogram, obtai
 
 #include <iostream>
 #include <vector>
+#include <memory>
+#include <stdexcept>
 
-#include "Utils.h"
-#include "CImg.h"
+#include "HistogramEqualizer.h"
 
 using namespace cimg_library;
 
+//output file of an image written to disk (batch and raw modes), the input name with "_equalised" before the extension
+string GetBatchOutputName(const string& input_file)
+{
+	size_t extension = input_file.find_last_of('.');
+	if (extension == string::npos || input_file.find_first_of("/\\", extension) != string::npos)
+		return input_file + "_equalised";
+	return input_file.substr(0, extension) + "_equalised" + input_file.substr(extension);
+}
+
 int main(int argc, char** argv)
 {
 	// Part 1 - handle command line options such as device selection
 	int platform_id = 0;
 	int device_id = 0;
-	int mode_id = 0;
+	HistogramEqualizer::Options options;
 	string image_filename = "test.ppm";
+	string batch_path;
+	bool raw_pnm = false;
+	size_t memory_budget = 0; //bytes, streams the image in tiles when set
 
 	for (int i = 1; i < argc; i++)
 	{
@@ -34,9 +47,43 @@ int main(int argc, char** argv)
 		else if ((strcmp(argv[i], "-d") == 0) && (i < (argc - 1)))
 			device_id = atoi(argv[++i]);
 		else if ((strcmp(argv[i], "-m") == 0) && (i < (argc - 1)))
-			mode_id = atoi(argv[++i]);
+			options.mode_id = atoi(argv[++i]);
 		else if ((strcmp(argv[i], "-f") == 0) && (i < (argc - 1)))
 			image_filename = argv[++i];
+		else if ((strcmp(argv[i], "-ppi") == 0) && (i < (argc - 1)))
+			options.pixels_per_item = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-v") == 0)
+			options.vectorised = true;
+		else if (strcmp(argv[i], "-sg") == 0)
+			options.subgroups = true;
+		else if ((strcmp(argv[i], "-r") == 0) && (i < (argc - 1)))
+			options.replicas = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-c") == 0)
+			options.colour = true;
+		else if (strcmp(argv[i], "-y") == 0)
+			options.luminance = true;
+		else if ((strcmp(argv[i], "-s") == 0) && (i < (argc - 1)))
+			options.scan_strategy = atoi(argv[++i]);
+		else if ((strcmp(argv[i], "-k") == 0) && (i < (argc - 1)))
+			options.scan_strip = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-ch") == 0)
+			options.keep_chist = true;
+		else if (strcmp(argv[i], "-o") == 0)
+			options.in_place = false;
+		else if (strcmp(argv[i], "-cb") == 0)
+			options.copy_benchmark = true;
+		else if (strcmp(argv[i], "-nz") == 0)
+			options.zero_copy = false;
+		else if ((strcmp(argv[i], "-pc") == 0) && (i < (argc - 1)))
+			options.program_cache = argv[++i];
+		else if (strcmp(argv[i], "-npc") == 0)
+			options.program_cache.clear();
+		else if (strcmp(argv[i], "-raw") == 0)
+			raw_pnm = true;
+		else if ((strcmp(argv[i], "-mb") == 0) && (i < (argc - 1)))
+			memory_budget = (size_t)atoi(argv[++i]) << 20;
+		else if ((strcmp(argv[i], "-b") == 0) && (i < (argc - 1)))
+			batch_path = argv[++i];
 		else if (strcmp(argv[i], "-h") == 0)
 		{
 			// print help info to the console
@@ -46,10 +93,59 @@ int main(int argc, char** argv)
 			std::cerr << "  -p : select platform" << std::endl;
 			std::cerr << "  -d : select device" << std::endl;
 			std::cerr << "  -m : select run mode" << std::endl;
+			std::cerr << "       ATTENTION: for 8-bit images without other histogram options mode 0 fuses the histogram, scan and LUT into one kernel" << std::endl;
+			std::cerr << "       ATTENTION: 0 and 1 use the optimised kernels (0 scans 16-bit histograms in a single pass with a decoupled look-back," << std::endl;
+			std::cerr << "                  1 scans them with the multi-level block sum scan), 2 uses the basic kernels," << std::endl;
+			std::cerr << "                  3 uses the sort-based histogram engine for 16-bit images" << std::endl;
 			std::cerr << "  -f : specify input image file" << std::endl;
 			std::cerr << "       ATTENTION: 1. \"test.ppm\" is default" << std::endl;
-			std::cerr << "                  2. Please select a PPM image file (8-bit/16-bit RGB)" << std::endl;
+			std::cerr << "                  2. Please select a PPM image file (8-bit to 16-bit RGB, the bin count follows the maxval of the header)" << std::endl;
 			std::cerr << "                  3. The specified image should be put under the folder \"images\"" << std::endl;
+			std::cerr << "  -ppi : pixels per work-item for the coarsened (grid-stride) histogram kernels" << std::endl;
+			std::cerr << "         ATTENTION: 1. 0 is default and keeps one pixel per work-item for 8-bit images" << std::endl;
+			std::cerr << "                    2. The workgroup count is bounded by the compute units times an occupancy factor" << std::endl;
+			std::cerr << "  -v : use vectorised kernels (uchar16 for 8-bit, ushort8 for 16-bit)" << std::endl;
+			std::cerr << "       ATTENTION: 1. Applies to the histogram kernel (unless -ppi is given or the privatized 16-bit kernel is used) and the output kernel" << std::endl;
+			std::cerr << "                  2. Image tails that are not a multiple of the vector width are handled by the scalar kernels" << std::endl;
+			std::cerr << "                  3. The output kernel caches the LUT in local memory, or in constant memory for 16-bit LUTs that do not fit" << std::endl;
+			std::cerr << "  -sg : use sub-group aggregated atomics in the histogram kernel" << std::endl;
+			std::cerr << "        ATTENTION: falls back to the default kernels if the device reports neither cl_khr_subgroups nor cl_intel_subgroups" << std::endl;
+			std::cerr << "  -r : number of replicated local sub-histograms for 8-bit images" << std::endl;
+			std::cerr << "       ATTENTION: 1. 1 is default and keeps a single local histogram per workgroup" << std::endl;
+			std::cerr << "                  2. The count is limited by the device local memory size and the workgroup size" << std::endl;
+			std::cerr << "  -c : equalise every colour channel with its own histogram and LUT" << std::endl;
+			std::cerr << "       ATTENTION: the per-channel kernels are used, so -ppi, -r, -v and -sg are ignored" << std::endl;
+			std::cerr << "  -y : equalise only the luminance (RGB -> YCbCr -> equalise Y -> RGB) of a colour image" << std::endl;
+			std::cerr << "       ATTENTION: 1. The conversion is fused into the histogram and output kernels, so -c, -ppi, -r, -v and -sg are ignored" << std::endl;
+			std::cerr << "                  2. Only images with 3 channels are supported" << std::endl;
+			std::cerr << "  -s : select the cumulative histogram scan strategy for run modes 0 and 1" << std::endl;
+			std::cerr << "       ATTENTION: 1. 0 uses the Hillis-Steele scan (default), 1 uses the work-efficient Blelloch scan (two bins per work-item)," << std::endl;
+			std::cerr << "                     2 uses the register-blocked scan (a strip of bins per work-item, see -k)" << std::endl;
+			std::cerr << "                  2. Applies to 8-bit images and the per-block stage of 16-bit images in run mode 1" << std::endl;
+			std::cerr << "  -k : bins per work-item of the register-blocked scan, compiled into the kernels (8 is default, 64 at most)" << std::endl;
+			std::cerr << "  -ch : keep the cumulative histogram and print it with the histogram and the LUT" << std::endl;
+			std::cerr << "        ATTENTION: in run modes 0 and 1 the scan writes the LUT directly, so the c-hist is only stored when it is asked for" << std::endl;
+			std::cerr << "  -o : keep the original image and write the output to a separate buffer and image" << std::endl;
+			std::cerr << "       ATTENTION: by default the output overwrites the input buffer and is read back into the loaded image" << std::endl;
+			std::cerr << "  -cb : time a plain device copy of the image and report its GB/s next to the output kernel" << std::endl;
+			std::cerr << "        ATTENTION: the copy goes to an extra buffer and is only enqueued with this option" << std::endl;
+			std::cerr << "  -nz : copy the image to and from device buffers on devices with unified host memory as well" << std::endl;
+			std::cerr << "        ATTENTION: by default images (and -o outputs) are kept in page-aligned memory that such devices use without a copy" << std::endl;
+			std::cerr << "  -pc : directory of the program binary cache (kernels/cache by default)" << std::endl;
+			std::cerr << "        ATTENTION: a binary is rebuilt when the platform, device, driver, build options or kernel source change" << std::endl;
+			std::cerr << "  -npc : always build the program from source, without the binary cache" << std::endl;
+			std::cerr << "  -raw : map a binary PGM/PPM file (P5/P6) and equalise its pixel data as it is stored, without decoding it" << std::endl;
+			std::cerr << "         ATTENTION: 1. The kernels index the interleaved channels and swap the bytes of 16-bit samples themselves" << std::endl;
+			std::cerr << "                    2. The output is written next to the input with \"_equalised\" added to the name, nothing is displayed" << std::endl;
+			std::cerr << "                    3. Other files are decoded with CImg as without -raw" << std::endl;
+			std::cerr << "  -mb : device memory budget in MB, the image is streamed from the file in tiles that fit in it" << std::endl;
+			std::cerr << "        ATTENTION: 1. Only binary PGM/PPM files (P5/P6) are streamed, all channels share one histogram" << std::endl;
+			std::cerr << "                   2. The file is read twice (histogram pass, then output pass) and the output is written" << std::endl;
+			std::cerr << "                      next to the input with \"_equalised\" added to the name, nothing is displayed" << std::endl;
+			std::cerr << "  -b : equalise every PPM/PGM image of a directory, or every image listed (one path per line) in a text file" << std::endl;
+			std::cerr << "       ATTENTION: 1. The outputs are written next to the inputs with \"_equalised\" added to the name, nothing is displayed" << std::endl;
+			std::cerr << "                  2. Images are decoded and encoded on host threads and uploads, kernels and downloads of" << std::endl;
+			std::cerr << "                     consecutive images overlap; the images per second and stage idle times are reported" << std::endl;
 			std::cerr << "  -h : print this message" << std::endl;
 			return 0;
 		}
@@ -59,431 +155,199 @@ int main(int argc, char** argv)
 	//the try from the exception handling
 	try
 	{
-		// loading image
-		CImg<unsigned short> input_image(image_path.c_str()); // reads data from the image file
-		CImg<unsigned char> input_image_8;
-
-		size_t input_image_elements = input_image.size(); // number of elements
-		size_t input_image_size = input_image_elements * sizeof(unsigned short); // size in bytes
-		int input_image_width = input_image.width(), input_image_height = input_image.height();
-
-		// image bin numbers
-		int bin_count = input_image.max() <= 255 ? 256 : 65536;
-
-
-		float scale = 1.0f; // image output scale
-
-
-		CImgDisplay input_image_display;
-
-		// detects image using bin count - either 8bit in the if statement or 16 bit outside of it
-		if (bin_count == 256)
+		//batch mode, the images are written to files instead of being displayed
+		if (!batch_path.empty())
 		{
-			input_image_8.load(image_path.c_str());
-			input_image_size = input_image_elements * sizeof(unsigned char);
-
-			//displays image
-			input_image_display.assign(CImg<unsigned char>(input_image_8), "Input image 8bit");
-		}
-		else
+			vector<string> input_files, output_files;
 
-			//displays the image but for 16bit instead of 8bit
-			input_image_display.assign(CImg<unsigned short>(input_image), "Input image 16bit");
-
-		// Part 3 - host operations
-		// 3.1 Select computing devices
-		cl::Context context = GetContext(platform_id, device_id);
+			if (cimg::is_directory(batch_path.c_str()))
+			{
+				CImgList<char> files = cimg::files(batch_path.c_str(), false, 0, true);
+				for (unsigned int i = 0; i < files.size(); i++)
+				{
+					string file = files[i].data();
+					string extension = file.size() > 4 ? file.substr(file.size() - 4) : "";
+					//outputs of an earlier batch are not equalised again
+					if ((!cimg::strcasecmp(extension.c_str(), ".ppm") || !cimg::strcasecmp(extension.c_str(), ".pgm")) && file.find("_equalised") == string::npos)
+						input_files.push_back(file);
+				}
+			}
+			else
+			{
+				ifstream list(batch_path);
+				string file;
 
-		std::cout << GetPlatformName(platform_id) << ", " << GetDeviceName(platform_id, device_id) << std::endl;
+				if (!list)
+					throw std::runtime_error("Cannot open the batch list " + batch_path);
 
-		//create a queue to which we will push commands to the device
-		cl::CommandQueue queue(context, CL_QUEUE_PROFILING_ENABLE);
+				while (getline(list, file))
+				{
+					if (!file.empty() && file.back() == '\r')
+						file.pop_back();
+					if (!file.empty())
+						input_files.push_back(file);
+				}
+			}
 
-		// 3.2 Load & build the device code
-		cl::Program::Sources sources;
-		AddSources(sources, "kernels/my_kernels.cl");
-		cl::Program program(context, sources);
+			if (input_files.empty())
+				throw std::runtime_error("No PPM/PGM images to equalise in " + batch_path);
 
+			for (unsigned int i = 0; i < input_files.size(); i++)
+				output_files.push_back(GetBatchOutputName(input_files[i]));
 
-		// build and debug the kernel code
-		try
-		{
-			program.build();
-		}
-		catch (const cl::Error& err)
-		{
-			std::cout << "Build Status: " << program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(context.getInfo<CL_CONTEXT_DEVICES>()[0]) << std::endl;
-			std::cout << "Build Options:\t" << program.getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(context.getInfo<CL_CONTEXT_DEVICES>()[0]) << std::endl;
-			std::cout << "Build Log:\t " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(context.getInfo<CL_CONTEXT_DEVICES>()[0]) << std::endl;
-			throw err;
+			options.print_histograms = false;
+			HistogramEqualizer equalizer(platform_id, device_id, options);
+			equalizer.EqualizeFiles(input_files, output_files);
+			return 0;
 		}
 
-		// Part 4 - memory allocation
-		typedef unsigned int standard; //use unsigned int to avoid overflow
-		std::vector<standard> H(bin_count, 0); //vector to store hist
-		size_t H_elements = H.size();
-		size_t H_size = H_elements * sizeof(standard);
-
-		std::vector<standard> CH(H_elements, 0); //vector to store c-hist
-		size_t CH_elements = CH.size();
-		size_t CH_size = CH_elements * sizeof(standard);
-
-
-		//number of local elements is taken from the num of bins (8bit)
-		//8bit only needs one workgroup
-		size_t local_elements_8 = 256;
-		size_t local_size_8 = local_elements_8 * sizeof(standard);
-
-		//adjusts the length of global elements of the histogram kernel for an 8-bit image;
-		//this is to try and ensure that the global size is a multiple of the local size for the padding 
-		size_t kernel1_global_elements_8 = input_image_elements;
-
-		size_t kernel1_global_elements_8_padding = kernel1_global_elements_8 % local_elements_8;
-		if (kernel1_global_elements_8_padding)
-			kernel1_global_elements_8 += (local_elements_8 - kernel1_global_elements_8_padding);
-
-		//16bit image size segment
-		size_t local_elements_16 = cl::Kernel(program, "get_chist_HS").getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(context.getInfo<CL_CONTEXT_DEVICES>()[0]);
-
-		//obtain max workgroup size
-		size_t local_size_16 = local_elements_16 * sizeof(standard);
-		size_t group_count = bin_count == 256 ? 1 : CH_elements / local_elements_16;
-
-
-
+		//the engine keeps the device, program and buffers, so it could equalise any number of images from here
+		HistogramEqualizer equalizer(platform_id, device_id, options);
 
-		mode_id = (mode_id == 1 && bin_count == 65536 && (group_count & (group_count - 1))) ? 0 : mode_id;//obtaining mode id as to either use a basic version or a more optimised version
-
-
-		//adjusting the length of global elements for 16bit
-		// trying to get the global size to be a multiple of the local size for the padding
-		size_t kernel2_global_elements_16 = H_elements;
-
-		size_t kernel2_global_elements_16_padding = kernel2_global_elements_16 % local_elements_16;
-		if (kernel2_global_elements_16_padding)
-			kernel2_global_elements_16 += (local_elements_16 - kernel2_global_elements_16_padding);
-
-		//using a vector to store the block sums
-		std::vector<standard> BS(group_count, 0);
-		size_t BS_size = BS.size() * sizeof(standard);
-
-		//vector is equal to the num of workgroups to scan the block sums
-		std::vector<standard> BS_scanned(group_count, 0);
-
-		// size in bytes
-		size_t BS_scanned_size = BS_scanned.size() * sizeof(standard);
-		std::vector<standard> LUT(CH_elements, 0);//using a vector to store the LUT
-
-		//a LUT for a c-hist
-		size_t LUT_size = LUT.size() * sizeof(standard);
-
-		// Part 5 - device operations
-		// device - buffers
-		cl::Buffer buffer_input_image(context, CL_MEM_READ_ONLY, input_image_size);
-
-		//histogram buffer
-		cl::Buffer buffer_H(context, CL_MEM_READ_WRITE, H_size);
-
-		//c-hist buffer
-		cl::Buffer buffer_CH(context, CL_MEM_READ_WRITE, CH_size);
-
-		//block sum buffer
-		cl::Buffer buffer_BS(context, CL_MEM_READ_WRITE, BS_size);
-
-		//scanned block sum buffer
-		cl::Buffer buffer_BS_scanned(context, CL_MEM_READ_WRITE, BS_scanned_size);
-
-		// LUT buffer
-		cl::Buffer buffer_LUT(context, CL_MEM_READ_WRITE, LUT_size);
+		//out-of-core mode: neither the host nor the device holds more than two tiles of the image
+		if (memory_budget)
+		{
+			string output_path = GetBatchOutputName(image_path);
+			equalizer.EqualizeStreamed(image_path, output_path, memory_budget);
 
-		// LUT buffer
-		cl::Buffer buffer_output_image(context, CL_MEM_READ_WRITE, input_image_size);
+			std::cout << "Output image written to " << output_path << std::endl;
+			return 0;
+		}
 
-		// 5.1 Copy the image to and initialise other arrays on device memory
-		cl::Event input_image_event, H_input_event, CH_input_event, BS_input_event, BS_scanned_input_event, LUT_input_event;
+		//raw ingest: only the header is parsed, the mapped payload is equalised in place and written out with the header,
+		//so the host never holds a second copy of the pixels
+		if (raw_pnm)
+		{
+			int width, height, channels, max_value;
+			size_t payload_offset = 0;
 
-		if (bin_count == 256)
-			queue.enqueueWriteBuffer(buffer_input_image, CL_TRUE, 0, input_image_size, &input_image_8.data()[0], NULL, &input_image_event);
-		else
-			queue.enqueueWriteBuffer(buffer_input_image, CL_TRUE, 0, input_image_size, &input_image.data()[0], NULL, &input_image_event);
+			if (GetPNMHeader(image_path, width, height, channels, max_value, &payload_offset))
+			{
+				MappedFile file(image_path);
+				size_t payload_size = (size_t)width * height * channels * (max_value <= 255 ? 1 : 2);
 
-		//histogram buffer 0
-		queue.enqueueFillBuffer(buffer_H, 0, 0, H_size, NULL, &H_input_event);
+				if (file.data()[0] == 'P' && (file.data()[1] == '5' || file.data()[1] == '6') && payload_offset + payload_size <= file.size())
+				{
+					equalizer.equalizePNMPayload(file.data() + payload_offset, width, height, channels, max_value);
 
-		//c-hist buffer 0
-		queue.enqueueFillBuffer(buffer_CH, 0, 0, CH_size, NULL, &CH_input_event);
+					string output_path = GetBatchOutputName(image_path);
+					ofstream output(output_path, ios::binary);
+					output.write((const char*)file.data(), payload_offset + payload_size);
 
-		//LUT buffer 0
-		queue.enqueueFillBuffer(buffer_LUT, 0, 0, LUT_size, NULL, &LUT_input_event);
+					if (!output)
+					{
+						std::cerr << "ERROR: Cannot write " << output_path << std::endl;
+						return 1;
+					}
 
-		if (bin_count == 65536)
-		{
-			queue.enqueueFillBuffer(buffer_BS, 0, 0, BS_size, NULL, &BS_input_event); //0 block sum buffer
+					std::cout << "Output image written to " << output_path << std::endl;
+					return 0;
+				}
+			}
 
-			if (mode_id == 0)
-				queue.enqueueFillBuffer(buffer_BS_scanned, 0, 0, BS_scanned_size, NULL, &BS_scanned_input_event); //0 scanned block sum buffer
+			std::cerr << "Raw ingest needs a binary PGM/PPM file (P5/P6), decoding with CImg" << std::endl;
 		}
 
-		// 5.2 Setup and execute the kernel
-		cl::Kernel kernel1, kernel2, kernel2_helper1, kernel2_helper2, kernel2_helper3;
+		//on devices that share the host memory the image is decoded into page-aligned memory the device uses in place,
+		//the header gives the size to allocate and CImg decodes into the shared image without reallocating it
+		int width, height, channels, max_value = 0;
+		bool header_read = GetPNMHeader(image_path, width, height, channels, max_value);
+		bool zero_copy = equalizer.IsZeroCopy() && header_read;
+		std::unique_ptr<HostMemory> input_memory, input_memory_8, output_memory;
+		CImg<unsigned short> input_image;
 
-		//use am optimised version if any are available
-		if (mode_id == 0 || mode_id == 1)
+		if (zero_copy)
 		{
-			if (bin_count == 256)
-			{
-				std::cout << "Using optimised histogram and cumulative histogram kernels" << std::endl;
-
-				kernel1 = cl::Kernel(program, "get_hist_8LC");
-				//get a hist with a specified number of bins
+			input_memory.reset(new HostMemory((size_t)width * height * channels * sizeof(unsigned short)));
+			input_image.assign((unsigned short*)input_memory->data(), width, height, 1, channels, true);
+		}
 
+		// loading image
+		input_image.load(image_path.c_str()); // reads data from the image file
 
-				kernel2 = cl::Kernel(program, "get_chist_HS");
-				//get a c-hist
+		//the maxval of the header decides the bit depth and the bin count; the image data decides if the header cannot be read
+		if (!header_read)
+			max_value = input_image.max() <= 255 ? 255 : 65535;
 
+		float scale = 1.0f; // image output scale
 
-				kernel1.setArg(2, cl::Local(local_size_8));
-				//local memory size for a local histogram
+		CImgDisplay input_image_display, output_image_display;
 
+		//in-place mode equalises the loaded image itself, otherwise the output goes to a separate image and the original is kept
+		// detects image using the maxval - either 8bit in the if statement or 16 bit outside of it
+		if (max_value <= 255)
+		{
+			//the conversion to bytes writes into page-aligned memory as well for zero-copy devices
+			CImg<unsigned char> input_image_8;
 
-				kernel1.setArg(3, (standard)input_image_elements);
+			if (zero_copy)
+			{
+				input_memory_8.reset(new HostMemory(input_image.size()));
+				input_image_8.assign((unsigned char*)input_memory_8->data(), input_image.width(), input_image.height(), input_image.depth(), input_image.spectrum(), true);
+			}
 
+			input_image_8 = input_image;
+			input_image.assign();
+			input_memory.reset();
 
-				kernel2.setArg(2, cl::Local(local_size_8));
+			//displays image
+			input_image_display.assign(input_image_8, "Input image 8bit");
 
+			if (options.in_place)
+			{
+				equalizer.equalize(input_image_8.data(), input_image_8.width(), input_image_8.height() * input_image_8.depth(), input_image_8.spectrum(), max_value);
 
-				kernel2.setArg(3, cl::Local(local_size_8));
-				//local memory size for a c-hist
+				//output the 8bit image and resize if needed
+				output_image_display.assign(input_image_8.resize((int)(input_image_8.width() * scale), (int)(input_image_8.height() * scale)), "Output image (8-bit)");
 			}
-
 			else
 			{
-				std::cout << "Using optimised cumulative histogram kernel";
-
-				//get a histogram with a specified number of bins;
-				//only for 8bit
+				//the output is written into page-aligned memory as well, so the device writes it without a copy
+				CImg<unsigned char> output_image_8;
 
-				kernel1 = cl::Kernel(program, "get_hist_16");
-
-				kernel2 = cl::Kernel(program, "get_chist_HS"); //get a starting c-hist
-				kernel2_helper1 = cl::Kernel(program, "get_B_S"); //get block sums of a starting c-hist
-
-				if (mode_id == 0 || mode_id == 2)
+				if (zero_copy)
 				{
-					std::cout << std::endl;
-
-					kernel2_helper2 = cl::Kernel(program, "get_scanned_BS_1"); //get scanned block sums
-
-					kernel2_helper2.setArg(1, buffer_BS_scanned);
+					output_memory.reset(new HostMemory(input_image_8.size()));
+					output_image_8.assign((unsigned char*)output_memory->data(), input_image_8.width(), input_image_8.height(), input_image_8.depth(), input_image_8.spectrum(), true);
 				}
 				else
-				{
-					std::cout << " including a helper kernel different from Fast Mode 1" << std::endl;
+					output_image_8.assign(input_image_8.width(), input_image_8.height(), input_image_8.depth(), input_image_8.spectrum());
 
-					kernel2_helper2 = cl::Kernel(program, "get_scanned_BS_2"); //get scanned block sums
-				}
-
-				kernel2_helper3 = cl::Kernel(program, "get_complete_chist"); //get a complete c-hist
-
-
-				kernel2.setArg(2, cl::Local(local_size_16)); //set local memory for local hist
-				kernel2.setArg(3, cl::Local(local_size_16)); //set local memory for a c-hist
-
-				kernel2_helper1.setArg(0, buffer_CH);
-
-				kernel2_helper1.setArg(1, buffer_BS);
-
-				kernel2_helper1.setArg(2, (int)local_elements_16);
-
-				kernel2_helper2.setArg(0, buffer_BS);
-
-				if (mode_id == 0 || mode_id == 2)
-					kernel2_helper3.setArg(0, buffer_BS_scanned);
-				else
-					kernel2_helper3.setArg(0, buffer_BS);
+				equalizer.equalize(input_image_8.data(), output_image_8.data(), input_image_8.width(), input_image_8.height() * input_image_8.depth(), input_image_8.spectrum(), max_value);
 
-				kernel2_helper3.setArg(1, buffer_CH);
+				output_image_display.assign(output_image_8.resize((int)(output_image_8.width() * scale), (int)(output_image_8.height() * scale)), "Output image (8-bit)");
 			}
 		}
-
-		//use basic version
 		else
 		{
-			std::cout << "Using basic kernels" << std::endl;
-
-			//get a histogram with a specified number of bins
-			if (bin_count == 256)
-				kernel1 = cl::Kernel(program, "get_hist_8");
-			else
-				kernel1 = cl::Kernel(program, "get_hist_16");
-
-			kernel2 = cl::Kernel(program, "get_chist"); //get a c-hist
-
-			kernel2.setArg(2, bin_count);
-		}
-
-		std::cout << "----------------------------------" << std::endl;
-
-		cl::Kernel kernel3 = cl::Kernel(program, "get_LUT"); //get a LUT froma normalised c-hist
-		cl::Kernel kernel4;
-
-		//get the output image using the lut
-		if (bin_count == 256)
-			kernel4 = cl::Kernel(program, "get_Output8");
-		else
-			kernel4 = cl::Kernel(program, "get_Output16");
-
-		kernel1.setArg(0, buffer_input_image);
-
-		kernel1.setArg(1, buffer_H);
-
-		kernel2.setArg(0, buffer_H);
-
-		kernel2.setArg(1, buffer_CH);
-
-		kernel3.setArg(0, buffer_CH);
-
-		kernel3.setArg(1, buffer_LUT);
-
-		kernel3.setArg(2, bin_count);
-
-		kernel3.setArg(3, input_image_width * input_image_height);
-
-
-		kernel4.setArg(0, buffer_input_image);
-
-		kernel4.setArg(1, buffer_LUT);
-
-		kernel4.setArg(2, buffer_output_image);
-
-		cl::Event kernel1_event, kernel2_event, kernel2_helper1_event, kernel2_helper2_event, kernel2_helper3_event, kernel3_event, kernel4_event;
-
-		if ((mode_id == 0 || mode_id == 1) && bin_count == 256)
-			queue.enqueueNDRangeKernel(kernel1, cl::NullRange, cl::NDRange(kernel1_global_elements_8), cl::NDRange(local_elements_8), NULL, &kernel1_event);
-		else
-			queue.enqueueNDRangeKernel(kernel1, cl::NullRange, cl::NDRange(input_image_elements), cl::NullRange, NULL, &kernel1_event);
+			//displays the image but for 16bit instead of 8bit
+			input_image_display.assign(input_image, "Input image 16bit");
 
-		if ((mode_id == 0 || mode_id == 1) && bin_count == 65536)
-		{
-			queue.enqueueNDRangeKernel(kernel2, cl::NullRange, cl::NDRange(kernel2_global_elements_16), cl::NDRange(local_elements_16), NULL, &kernel2_event);
-			queue.enqueueNDRangeKernel(kernel2_helper1, cl::NullRange, cl::NDRange(group_count), cl::NullRange, NULL, &kernel2_helper1_event);
+			if (options.in_place)
+			{
+				equalizer.equalize(input_image.data(), input_image.width(), input_image.height() * input_image.depth(), input_image.spectrum(), max_value);
 
-			if (mode_id == 0)
-				queue.enqueueNDRangeKernel(kernel2_helper2, cl::NullRange, cl::NDRange(group_count), cl::NullRange, NULL, &kernel2_helper2_event);
+				//output 16bit image and resize if needed
+				output_image_display.assign(input_image.resize((int)(input_image.width() * scale), (int)(input_image.height() * scale)), "Output image (16-bit)");
+			}
 			else
-				queue.enqueueNDRangeKernel(kernel2_helper2, cl::NullRange, cl::NDRange(group_count), cl::NDRange(group_count), NULL, &kernel2_helper2_event);
-
-			queue.enqueueNDRangeKernel(kernel2_helper3, cl::NullRange, cl::NDRange(kernel2_global_elements_16), cl::NDRange(local_elements_16), NULL, &kernel2_helper3_event);
-		}
-		else if ((mode_id == 0 || mode_id == 1) && bin_count == 256)
-			queue.enqueueNDRangeKernel(kernel2, cl::NullRange, cl::NDRange(H_elements), cl::NDRange(local_elements_8), NULL, &kernel2_event);
-		else
-			queue.enqueueNDRangeKernel(kernel2, cl::NullRange, cl::NDRange(H_elements), cl::NullRange, NULL, &kernel2_event);
-
-		queue.enqueueNDRangeKernel(kernel3, cl::NullRange, cl::NDRange(CH_elements), cl::NullRange, NULL, &kernel3_event);
-
-		queue.enqueueNDRangeKernel(kernel4, cl::NullRange, cl::NDRange(input_image_elements), cl::NullRange, NULL, &kernel4_event);
-
-		//print info to the console and display the output image
-		queue.enqueueReadBuffer(buffer_H, CL_TRUE, 0, H_size, &H[0]);
-		queue.enqueueReadBuffer(buffer_CH, CL_TRUE, 0, CH_size, &CH[0]);
-
-		queue.enqueueReadBuffer(buffer_LUT, CL_TRUE, 0, LUT_size, &LUT[0]);
-		std::cout << "H = " << H << std::endl;
-		std::cout << "----------------------------------" << std::endl;
-		std::cout << "CH = " << CH << std::endl;
-		std::cout << "----------------------------" << std::endl;
-		if ((mode_id == 0 || mode_id == 1) && bin_count == 65536)
-		{
-			queue.enqueueReadBuffer(buffer_BS, CL_TRUE, 0, BS_size, &BS[0]);
-			std::cout << "BS = " << BS << std::endl;
-			std::cout << "--------------------------------------" << std::endl;
-			if (mode_id == 0)
 			{
-				queue.enqueueReadBuffer(buffer_BS_scanned, CL_TRUE, 0, BS_scanned_size, &BS_scanned[0]);
-				std::cout << "BS_scanned = " << BS_scanned << std::endl;
-				std::cout << "--------------------------------" << std::endl;
-			}
-		}
-		std::cout << "LUT = " << LUT << std::endl;
-		std::cout << "-------------------------" << std::endl;
-
-		cl::Event output_image_event;
-
-		CImgDisplay output_image_display;
-
-		if (bin_count == 256)
-		{
-			vector<unsigned char> output_buffer_8(input_image_elements); //unsigned char can be used for data from 8bit buffer
-			queue.enqueueReadBuffer(buffer_output_image, CL_TRUE, 0, output_buffer_8.size() * sizeof(unsigned char), &output_buffer_8.data()[0], NULL, &output_image_event);
-			CImg<unsigned char> output_image_8(output_buffer_8.data(), input_image_width, input_image_height, input_image.depth(), input_image.spectrum());
-
-
-			//output the 8bit image and resize if needed
-			output_image_display.assign(output_image_8.resize((int)(input_image_width * scale), (int)(input_image_height * scale)), "Output image (8-bit)");
-		}
-		else
-		{
-			vector<unsigned short> output_buffer_16(input_image_elements); //unsigned short is required for 16bit buffer
-			queue.enqueueReadBuffer(buffer_output_image, CL_TRUE, 0, output_buffer_16.size() * sizeof(unsigned short), &output_buffer_16.data()[0], NULL, &output_image_event);
-			CImg<unsigned short> output_image_16(output_buffer_16.data(), input_image_width, input_image_height, input_image.depth(), input_image.spectrum());
-
-
-			//output 16bit image and resize if needed
-			output_image_display.assign(output_image_16.resize((int)(input_image_width * scale), (int)(input_image_height * scale)), "Output image (16-bit)");
-		}
-		cl_ulong total_upload_time = input_image_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - input_image_event.getProfilingInfo<CL_PROFILING_COMMAND_START>()
-			+ H_input_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - H_input_event.getProfilingInfo<CL_PROFILING_COMMAND_START>()
-			+ CH_input_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - CH_input_event.getProfilingInfo<CL_PROFILING_COMMAND_START>()
-			+ LUT_input_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - LUT_input_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-
-
-		//total upload time of input vectors
-		cl_ulong kernel1_time = kernel1_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernel1_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-
-
-		//histogram kernel execution time
-		cl_ulong kernel2_time = kernel2_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernel2_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-
-
-		//c-hist kernel execution time
-		cl_ulong total_kernel_time = kernel1_time + kernel2_time
-			+ kernel3_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernel3_event.getProfilingInfo<CL_PROFILING_COMMAND_START>()
-			+ kernel4_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernel4_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-
-
-		//total execution time of kernels
-		cl_ulong output_image_download_time = output_image_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - output_image_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-
-		if ((mode_id == 0 || mode_id == 1) && bin_count == 65536)
-		{
-			cl_ulong kernel2_helper_time = kernel2_helper1_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernel2_helper1_event.getProfilingInfo<CL_PROFILING_COMMAND_START>()
-				+ kernel2_helper2_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernel2_helper2_event.getProfilingInfo<CL_PROFILING_COMMAND_START>()
-				+ kernel2_helper3_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernel2_helper3_event.getProfilingInfo<CL_PROFILING_COMMAND_START>(); //c-hist extra kernel execution time
-
-
-			total_upload_time += (BS_input_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - BS_input_event.getProfilingInfo<CL_PROFILING_COMMAND_START>());
+				CImg<unsigned short> output_image_16;
 
-			if (mode_id == 0)
-				total_upload_time += (BS_scanned_input_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - BS_scanned_input_event.getProfilingInfo<CL_PROFILING_COMMAND_START>());
+				if (zero_copy)
+				{
+					output_memory.reset(new HostMemory(input_image.size() * sizeof(unsigned short)));
+					output_image_16.assign((unsigned short*)output_memory->data(), input_image.width(), input_image.height(), input_image.depth(), input_image.spectrum(), true);
+				}
+				else
+					output_image_16.assign(input_image.width(), input_image.height(), input_image.depth(), input_image.spectrum());
 
-			kernel2_time += kernel2_helper_time;
+				equalizer.equalize(input_image.data(), output_image_16.data(), input_image.width(), input_image.height() * input_image.depth(), input_image.spectrum(), max_value);
 
-			//adds the helper kernel execution time so that the entire execution time is taken into account
-			total_kernel_time += kernel2_helper_time;
+				output_image_display.assign(output_image_16.resize((int)(output_image_16.width() * scale), (int)(output_image_16.height() * scale)), "Output image (16-bit)");
+			}
 		}
 
-		//execution times in microseconds, so total time is divided by 1000
-		std::cout << " Memory transfer time: " << total_upload_time / 1000 << "ms" << std::endl;
-		std::cout << " ---------------------------------------------------------" << std::endl;
-		std::cout << " Kernel execution time: " << total_kernel_time / 1000 << "ms" << std::endl;
-		std::cout << " ---------------------------------------------------------" << std::endl;
-		std::cout << " Histogram kernel execution time: " << kernel1_time / 1000 << "ms" << std::endl;
-		std::cout << " ---------------------------------------------------------" << std::endl;
-		std::cout << " Cumulative histogram kernel execution time: " << kernel2_time / 1000 << "ms" << std::endl;
-		std::cout << " ---------------------------------------------------------" << std::endl;
-		std::cout << " Program execution time: " << (total_upload_time + total_kernel_time + output_image_download_time) / 1000 << "ms" << std::endl;
-
 		//keeps the input and output images open while they are not closed and the escape key hasnt been pressed
 		while (!input_image_display.is_closed() && !output_image_display.is_closed()
 			&& !input_image_display.is_keyESC() && !output_image_display.is_keyESC())
@@ -501,6 +365,10 @@ int main(int argc, char** argv)
 	{
 		std::cerr << "CImg - ERROR: " << e.what() << std::endl;
 	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "ERROR: " << e.what() << std::endl;
+	}
 
 	return 0;
-}
\ No newline at end of file
+}
@@ -1,6 +1,56 @@
 //Kernel file for applying histogram equalisation on an RGB image
 //both 8 and 16 bit images have been used
 
+//the host builds the program with -D BIN_COUNT=<bins>, the PPM maxval rounded up to a power of two,
+//so the 16bit kernels are specialised for the bit depth of the image (e.g. 4096 bins for a 12bit image)
+#ifndef BIN_COUNT
+#define BIN_COUNT 65536
+#endif
+
+//bins per work-item of the register-blocked scan, set by the host with -D SCAN_STRIP=<K> so it can be tuned per device
+#ifndef SCAN_STRIP
+#define SCAN_STRIP 8
+#endif
+
+//the LUT is stored in the pixel type of the image (256 bytes for 8bit, 2 bytes per bin for 16bit),
+//so the output kernels gather a quarter or half of the bytes of a uint LUT
+#if BIN_COUNT <= 256
+#define LUT_TYPE uchar
+#else
+#define LUT_TYPE ushort
+#endif
+
+//raw PNM payloads are equalised as they are stored in the file, the host builds with -D SWAP_BYTES for the big-endian
+//16bit samples on a little-endian device and with -D INTERLEAVED_CHANNELS=<channels> for per-channel and luminance
+//kernels on interleaved (RGBRGB...) pixels; shared histograms and LUT outputs do not depend on the channel layout
+#ifdef SWAP_BYTES
+#define PIXEL16(x) rotate((ushort)(x), (ushort)8)
+#define PIXEL16_8(x) rotate((x), (ushort8)8)
+#else
+#define PIXEL16(x) (x)
+#define PIXEL16_8(x) (x)
+#endif
+
+//channel of an image element and element of a channel of a pixel, CImg images are planar (plane_elements per channel)
+#ifdef INTERLEAVED_CHANNELS
+#define CHANNEL_OF(index, plane_elements) ((index) % INTERLEAVED_CHANNELS)
+#define CHANNEL_ELEMENT(pixel, channel, plane_elements) ((pixel) * INTERLEAVED_CHANNELS + (channel))
+#else
+#define CHANNEL_OF(index, plane_elements) ((index) / (plane_elements))
+#define CHANNEL_ELEMENT(pixel, channel, plane_elements) ((channel) * (plane_elements) + (pixel))
+#endif
+
+//epilogue of the scan kernels: writes a finished c-hist bin and its normalised LUT entry
+//CH may be NULL when the c-hist is not kept, LUT may be NULL when the scan is not the last step of the c-hist
+//max_value is the maxval of the image and pixel_count the number of elements counted by each histogram
+void store_chist(global uint* CH, global LUT_TYPE* LUT, uint index, uint value, uint max_value, uint pixel_count)
+{
+	if (CH) CH[index] = value;
+
+	//ulong is needed so it doesnt overflow past the int
+	if (LUT) LUT[index] = ((ulong)value * max_value) / pixel_count;
+}
+
 //8 bit image histogram with specified bins
 kernel void get_hist_8(global uchar* image, global uint* H)
 {
@@ -13,7 +63,7 @@ kernel void get_hist_8(global uchar* image, global uint* H)
 kernel void get_hist_16(global const ushort* image, global uint* H)
 {
 	uint global_id = get_global_id(0);
-	atomic_inc(&H[image[global_id]]); //input image as bin index for 16bit
+	atomic_inc(&H[PIXEL16(image[global_id])]); //input image as bin index for 16bit
 }
 
 //8bit histogram using local memory
@@ -36,50 +86,471 @@ kernel void get_hist_8LC(global const uchar* image, global uint* H, local uint*
 	if (local_id < 256) atomic_add(&H[local_id], H_local[local_id]);
 }
 
+//vectorised 8bit histogram, each work-item loads 16 pixels with a single vload16
+//the host handles the tail of the image that is not a multiple of 16 with get_hist_8
+kernel void get_hist_8_V(global const uchar* image, global uint* H)
+{
+	uint global_id = get_global_id(0);
+	uchar16 pixels = vload16(global_id, image);
+
+	atomic_inc(&H[pixels.s0]); atomic_inc(&H[pixels.s1]); atomic_inc(&H[pixels.s2]); atomic_inc(&H[pixels.s3]);
+	atomic_inc(&H[pixels.s4]); atomic_inc(&H[pixels.s5]); atomic_inc(&H[pixels.s6]); atomic_inc(&H[pixels.s7]);
+	atomic_inc(&H[pixels.s8]); atomic_inc(&H[pixels.s9]); atomic_inc(&H[pixels.sa]); atomic_inc(&H[pixels.sb]);
+	atomic_inc(&H[pixels.sc]); atomic_inc(&H[pixels.sd]); atomic_inc(&H[pixels.se]); atomic_inc(&H[pixels.sf]);
+}
+
+//vectorised 16bit histogram, each work-item loads 8 pixels with a single vload8
+kernel void get_hist_16_V(global const ushort* image, global uint* H)
+{
+	uint global_id = get_global_id(0);
+	ushort8 pixels = PIXEL16_8(vload8(global_id, image));
+
+	atomic_inc(&H[pixels.s0]); atomic_inc(&H[pixels.s1]); atomic_inc(&H[pixels.s2]); atomic_inc(&H[pixels.s3]);
+	atomic_inc(&H[pixels.s4]); atomic_inc(&H[pixels.s5]); atomic_inc(&H[pixels.s6]); atomic_inc(&H[pixels.s7]);
+}
+
+//vectorised 8bit histogram using local memory
+//vector_elements is the number of whole uchar16 vectors in the image
+kernel void get_hist_8LC_V(global const uchar* image, global uint* H, local uint* H_local, const uint vector_elements)
+{
+	uint global_id = get_global_id(0);
+	int local_id = get_local_id(0);
+
+	if (local_id < 256) H_local[local_id] = 0; //set local hist to 0
+
+	barrier(CLK_LOCAL_MEM_FENCE); //wait for local threads to finish
+
+	if (global_id < vector_elements)
+	{
+		uchar16 pixels = vload16(global_id, image);
+
+		atomic_inc(&H_local[pixels.s0]); atomic_inc(&H_local[pixels.s1]); atomic_inc(&H_local[pixels.s2]); atomic_inc(&H_local[pixels.s3]);
+		atomic_inc(&H_local[pixels.s4]); atomic_inc(&H_local[pixels.s5]); atomic_inc(&H_local[pixels.s6]); atomic_inc(&H_local[pixels.s7]);
+		atomic_inc(&H_local[pixels.s8]); atomic_inc(&H_local[pixels.s9]); atomic_inc(&H_local[pixels.sa]); atomic_inc(&H_local[pixels.sb]);
+		atomic_inc(&H_local[pixels.sc]); atomic_inc(&H_local[pixels.sd]); atomic_inc(&H_local[pixels.se]); atomic_inc(&H_local[pixels.sf]);
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//local to global histogram
+	if (local_id < 256) atomic_add(&H[local_id], H_local[local_id]);
+}
+
+//8bit histogram using replicated local sub-histograms
+//work-item local_id updates replica local_id % replicas, which spreads the contention on each bin over the replicas;
+//replicas are 257 bins apart so the same bin of neighbouring replicas falls in different local memory banks
+kernel void get_hist_8LC_R(global const uchar* image, global uint* H, local uint* H_local, const uint image_elements, const uint replicas)
+{
+	uint global_id = get_global_id(0);
+	int local_id = get_local_id(0);
+	int local_size = get_local_size(0);
+
+	for (int i = local_id; i < replicas * 257; i += local_size) H_local[i] = 0; //set all replicas to 0
+
+	barrier(CLK_LOCAL_MEM_FENCE); //wait for local threads to finish
+
+	if (global_id < image_elements) atomic_inc(&H_local[(local_id % replicas) * 257 + image[global_id]]);
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//merge the replicas and flush them to the global histogram
+	if (local_id < 256)
+	{
+		uint bin_total = 0;
+		for (int r = 0; r < replicas; r++) bin_total += H_local[r * 257 + local_id];
+		atomic_add(&H[local_id], bin_total);
+	}
+}
+
+//8bit histogram using local memory with thread coarsening
+//a bounded number of groups is launched and each work-item walks the image with a grid-stride loop,
+//so the 256 global atomic_adds of the flush are paid once per group rather than once per 256 pixels
+kernel void get_hist_8LC_GS(global const uchar* image, global uint* H, local uint* H_local, const uint image_elements)
+{
+	uint global_id = get_global_id(0);
+	uint global_size = get_global_size(0);
+	int local_id = get_local_id(0);
+
+	if (local_id < 256) H_local[local_id] = 0; //set local hist to 0
+
+	barrier(CLK_LOCAL_MEM_FENCE); //wait for local threads to finish
+
+	//local histogram computation over many pixels per work-item
+	for (uint i = global_id; i < image_elements; i += global_size) atomic_inc(&H_local[image[i]]);
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//local to global histogram
+	if (local_id < 256) atomic_add(&H[local_id], H_local[local_id]);
+}
+
+//sub-group aggregated histogram updates, only compiled where the device supports sub-groups
+//the host checks the device extension string before using these kernels
+#if defined(cl_khr_subgroups) || defined(cl_intel_subgroups)
+#ifdef cl_khr_subgroups
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#endif
+#ifdef cl_intel_subgroups
+#pragma OPENCL EXTENSION cl_intel_subgroups : enable
+#endif
+
+//combines the lanes of a sub-group that share a bin, one round per distinct bin
+//returns the number of lanes with the same bin to one leader lane and 0 to the others
+//must be called by all lanes of the sub-group, inactive lanes pass active = 0
+uint sub_group_bin_count(uint bin, int active)
+{
+	uint lane = get_sub_group_local_id();
+	uint count = 0;
+	int pending = active;
+
+	while (sub_group_any(pending))
+	{
+		//the smallest pending bin of the sub-group is handled in this round
+		uint round_bin = sub_group_reduce_min(pending ? bin : UINT_MAX);
+		int match = pending && (bin == round_bin);
+		uint round_count = sub_group_reduce_add(match ? 1u : 0u);
+		uint leader = sub_group_reduce_min(match ? lane : UINT_MAX);
+
+		if (lane == leader) count = round_count;
+		if (match) pending = 0;
+	}
+
+	return count;
+}
+
+//8bit histogram using local memory with sub-group aggregated atomics
+kernel void get_hist_8LC_SG(global const uchar* image, global uint* H, local uint* H_local, const uint image_elements)
+{
+	uint global_id = get_global_id(0);
+	int local_id = get_local_id(0);
+
+	if (local_id < 256) H_local[local_id] = 0; //set local hist to 0
+
+	barrier(CLK_LOCAL_MEM_FENCE); //wait for local threads to finish
+
+	//padding work-items take part in the sub-group operations without counting a pixel
+	int active = global_id < image_elements;
+	uint bin = active ? image[global_id] : 0;
+	uint count = sub_group_bin_count(bin, active);
+
+	if (count) atomic_add(&H_local[bin], count);
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//local to global histogram
+	if (local_id < 256) atomic_add(&H[local_id], H_local[local_id]);
+}
+
+//16bit histogram with sub-group aggregated atomics
+kernel void get_hist_16_SG(global const ushort* image, global uint* H, const uint image_elements)
+{
+	uint global_id = get_global_id(0);
+
+	int active = global_id < image_elements;
+	uint bin = active ? PIXEL16(image[global_id]) : 0;
+	uint count = sub_group_bin_count(bin, active);
+
+	if (count) atomic_add(&H[bin], count);
+}
+#endif
+
+//16bit histogram using local memory
+//BIN_COUNT bins may not fit in local memory so the bin range is swept in passes of bins_per_pass bins
+//a fixed number of groups is launched and each work-item walks the image with a grid-stride loop,
+//so every group flushes its local bins once per pass rather than once per 256 pixels
+//per-channel histograms are laid out side by side (bin_total = channels * BIN_COUNT, plane_elements = width * height),
+//a single shared histogram uses bin_total = BIN_COUNT and plane_elements = image_elements
+kernel void get_hist_16LC(global const ushort* image, global uint* H, local uint* H_local, const uint image_elements, const uint bins_per_pass,
+	const uint plane_elements, const uint bin_total)
+{
+	uint global_id = get_global_id(0);
+	uint global_size = get_global_size(0);
+	int local_id = get_local_id(0);
+	int local_size = get_local_size(0);
+
+	for (uint bin_offset = 0; bin_offset < bin_total; bin_offset += bins_per_pass)
+	{
+		//a pass never spans two channels, so only the plane of the pass channel is read
+		//(every INTERLEAVED_CHANNELS-th element from the channel on for interleaved per-channel histograms)
+#ifdef INTERLEAVED_CHANNELS
+		uint stride = bin_total > BIN_COUNT ? INTERLEAVED_CHANNELS : 1;
+		uint plane_start = bin_offset / BIN_COUNT;
+		uint plane_end = image_elements;
+#else
+		uint stride = 1;
+		uint plane_start = (bin_offset / BIN_COUNT) * plane_elements;
+		uint plane_end = min(plane_start + plane_elements, image_elements);
+#endif
+		uint value_offset = bin_offset % BIN_COUNT;
+
+		for (int i = local_id; i < bins_per_pass; i += local_size) H_local[i] = 0; //set local hist to 0
+
+		barrier(CLK_LOCAL_MEM_FENCE); //wait for local threads to finish
+
+		//only pixels falling in the bin range of this pass are counted
+		for (uint i = plane_start + global_id * stride; i < plane_end; i += global_size * stride)
+		{
+			uint bin = PIXEL16(image[i]) - value_offset; //wraps around for pixels below the range
+			if (bin < bins_per_pass) atomic_inc(&H_local[bin]);
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		//local to global histogram, empty bins are skipped
+		//each work-item zeroes the same bins in the next pass so no extra barrier is needed
+		for (int i = local_id; i < bins_per_pass; i += local_size)
+			if (H_local[i]) atomic_add(&H[bin_offset + i], H_local[i]);
+	}
+}
+
+//per-channel 8bit histogram, the channel histograms are laid out side by side
+//CImg stores the image planar so the channel is the element offset divided by the plane size
+kernel void get_hist_8_C(global const uchar* image, global uint* H, const uint plane_elements)
+{
+	uint global_id = get_global_id(0);
+	atomic_inc(&H[CHANNEL_OF(global_id, plane_elements) * 256 + image[global_id]]);
+}
+
+//per-channel 16bit histogram
+kernel void get_hist_16_C(global const ushort* image, global uint* H, const uint plane_elements)
+{
+	uint global_id = get_global_id(0);
+	atomic_inc(&H[CHANNEL_OF(global_id, plane_elements) * BIN_COUNT + PIXEL16(image[global_id])]);
+}
+
+//per-channel 8bit histogram using local memory, bin_total = channels * 256 local bins
+kernel void get_hist_8LC_C(global const uchar* image, global uint* H, local uint* H_local, const uint image_elements, const uint plane_elements,
+	const uint bin_total)
+{
+	uint global_id = get_global_id(0);
+	int local_id = get_local_id(0);
+	int local_size = get_local_size(0);
+
+	for (int i = local_id; i < bin_total; i += local_size) H_local[i] = 0; //set local hist to 0
+
+	barrier(CLK_LOCAL_MEM_FENCE); //wait for local threads to finish
+
+	if (global_id < image_elements) atomic_inc(&H_local[CHANNEL_OF(global_id, plane_elements) * 256 + image[global_id]]);
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//local to global histogram, empty bins are skipped
+	for (int i = local_id; i < bin_total; i += local_size)
+		if (H_local[i]) atomic_add(&H[i], H_local[i]);
+}
+
+//luminance of a planar RGB pixel (full range BT.601 as used by JPEG YCbCr)
+float get_Y(float R, float G, float B)
+{
+	return 0.299f * R + 0.587f * G + 0.114f * B;
+}
+
+//8bit luminance histogram using local memory
+//RGB is converted to Y on the fly so no intermediate Y image is written, one work-item per pixel (not per element)
+kernel void get_hist_Y8(global const uchar* image, global uint* H, local uint* H_local, const uint plane_elements)
+{
+	uint global_id = get_global_id(0);
+	int local_id = get_local_id(0);
+
+	if (local_id < 256) H_local[local_id] = 0; //set local hist to 0
+
+	barrier(CLK_LOCAL_MEM_FENCE); //wait for local threads to finish
+
+	if (global_id < plane_elements)
+	{
+		float Y = get_Y(image[CHANNEL_ELEMENT(global_id, 0, plane_elements)], image[CHANNEL_ELEMENT(global_id, 1, plane_elements)],
+			image[CHANNEL_ELEMENT(global_id, 2, plane_elements)]);
+		atomic_inc(&H_local[convert_uchar_sat_rte(Y)]);
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//local to global histogram
+	if (local_id < 256) atomic_add(&H[local_id], H_local[local_id]);
+}
+
+//16bit luminance histogram
+kernel void get_hist_Y16(global const ushort* image, global uint* H, const uint plane_elements)
+{
+	uint global_id = get_global_id(0);
+
+	float Y = get_Y(PIXEL16(image[CHANNEL_ELEMENT(global_id, 0, plane_elements)]), PIXEL16(image[CHANNEL_ELEMENT(global_id, 1, plane_elements)]),
+		PIXEL16(image[CHANNEL_ELEMENT(global_id, 2, plane_elements)]));
+	atomic_inc(&H[convert_ushort_sat_rte(Y)]);
+}
+
 //cumulative histogram
-//last element = total numb of pixels
+//last element = total numb of counted elements
+//for per-channel histograms each channel of bin_count bins is scanned separately
 kernel void get_c_hist(global const uint* H, global uint* CH, const int bin_count)
 {
 	int global_id = get_global_id(0);
+	int channel_end = (global_id / bin_count + 1) * bin_count;
 	
-	for (int i = global_id + 1; i < bin_count && global_id < bin_count; i++)
+	for (int i = global_id + 1; i < channel_end; i++)
 	{
-		atomic_add(&CH[i], H[global_id] / 3);
+		atomic_add(&CH[i], H[global_id]);
 	}
 }
 
-//cumulative histogram using hillis and steele scan and local memory
+//the workgroup scan is selected when the program is built: work_group_scan_inclusive_add on OpenCL C 2.0 devices
+//(-D USE_WORK_GROUP_SCAN), a two-level sub-group scan on devices with a sub-group extension (-D USE_SUB_GROUP_SCAN),
+//otherwise the hillis and steele scan in local memory
+#if defined(USE_WORK_GROUP_SCAN) && (__OPENCL_C_VERSION__ < 300 || defined(__opencl_c_work_group_collective_functions))
+#define WORK_GROUP_SCAN
+#elif defined(USE_SUB_GROUP_SCAN) && (defined(cl_khr_subgroups) || defined(cl_intel_subgroups))
+#define SUB_GROUP_SCAN
+#endif
+
+//inclusive scan of one value per work-item across the workgroup
+//must be called by all work-items of the group, A and B need local_size entries and can be reused by the caller afterwards
+uint local_scan(uint value, local uint* A, local uint* B)
+{
+#if defined(WORK_GROUP_SCAN)
+	return work_group_scan_inclusive_add(value);
+#elif defined(SUB_GROUP_SCAN)
+	uint sub_group = get_sub_group_id();
+	uint sub_groups = get_num_sub_groups();
+	uint lane = get_sub_group_local_id();
+	uint lanes = get_sub_group_size();
+
+	value = sub_group_scan_inclusive_add(value);
+
+	if (lane == lanes - 1) A[sub_group] = value; //sub-group totals
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//the first sub-group scans the totals in chunks of its size
+	if (sub_group == 0)
+	{
+		uint carry = 0;
+
+		for (uint i = 0; i < sub_groups; i += lanes)
+		{
+			uint total = sub_group_scan_inclusive_add(i + lane < sub_groups ? A[i + lane] : 0) + carry;
+
+			if (i + lane < sub_groups) B[i + lane] = total;
+			carry = sub_group_broadcast(total, lanes - 1);
+		}
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (sub_group) value += B[sub_group - 1];
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	return value;
+#else
+	int local_id = get_local_id(0);
+	local uint* swap_value; //enables buffer swap
+
+	A[local_id] = value;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = 1; i < get_local_size(0); i *= 2)
+	{
+		if (local_id >= i) B[local_id] = A[local_id] + A[local_id - i];
+		else
+			B[local_id] = A[local_id];
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		//buffer swap
+		swap_value = B;
+		B = A;
+		A = swap_value;
+	}
+
+	value = A[local_id];
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	return value;
+#endif
+}
+
+//cumulative histogram using hillis and steele scan and local memory (or the collective scan of local_scan)
 //8 bit image, local elements should equal 256
 //16 bit needs helper kernels
-//last element in the cumulative histogram should equal the total num of pixels
-kernel void get_chist_HS(global const uint* H, global uint* CH, local uint* H_local, local uint* CH_local)
+//last element in the cumulative histogram should equal the total num of counted elements
+//for per-channel histograms each workgroup scans within one channel, as long as the local size divides the bin count
+//the LUT is written in the same pass when the whole c-hist fits in the workgroups (see store_chist)
+kernel void get_chist_HS(global const uint* H, global uint* CH, local uint* H_local, local uint* CH_local,
+	global LUT_TYPE* LUT, const uint max_value, const uint pixel_count)
 {
 	int global_id = get_global_id(0);
+	uint value = local_scan(H[global_id], H_local, CH_local); //H_local and CH_local are swapped in the scan
+
+	store_chist(CH, LUT, global_id, value, max_value, pixel_count);
+}
+
+//local memory index padding for the Blelloch scan, one extra entry every 32 entries so that
+//the strided tree accesses fall in different banks
+#define LOG_NUM_BANKS 5
+#define CONFLICT_FREE_OFFSET(n) ((n) >> LOG_NUM_BANKS)
+
+//cumulative histogram using a work-efficient Blelloch scan in local memory
+//every work-item handles two bins, so a block of 2 * local_size bins (256 bins need 128 work-items)
+//is scanned with O(n) additions; the exclusive result is made inclusive by adding the bins back
+//16 bit needs the same helper kernels as get_chist_HS, with blocks of 2 * local_size bins
+//temp needs 2 * local_size + 2 * local_size / 32 entries
+kernel void get_chist_BL(global const uint* H, global uint* CH, local uint* temp, global LUT_TYPE* LUT, const uint max_value, const uint pixel_count)
+{
 	int local_id = get_local_id(0);
-	local uint* swap_value;//enables buffer swap 
-	
-	H_local[local_id] = H[global_id]; //cache histogram values from global to local
-	
-	barrier(CLK_LOCAL_MEM_FENCE); //waiting for local threads to finish
-	
-	for (int i = 1; i < get_local_size(0); i *= 2){
-		if (local_id >= i) CH_local[local_id] = H_local[local_id] + H_local[local_id - i];
-		else
-			CH_local[local_id] = H_local[local_id];
-			
+	int n = 2 * get_local_size(0);
+	int block_start = get_group_id(0) * n;
+	int ai = local_id;
+	int bi = local_id + n / 2;
+	int offset = 1;
+
+	//cache both bins of the work-item from global to local
+	uint a = H[block_start + ai];
+	uint b = H[block_start + bi];
+	temp[ai + CONFLICT_FREE_OFFSET(ai)] = a;
+	temp[bi + CONFLICT_FREE_OFFSET(bi)] = b;
+
+	//up-sweep
+	for (int d = n / 2; d > 0; d /= 2)
+	{
 		barrier(CLK_LOCAL_MEM_FENCE);
-		
-		//buffer swap
-		swap_value = CH_local;
-		CH_local = H_local;
-		H_local = swap_value;
+
+		if (local_id < d)
+		{
+			int i = offset * (2 * local_id + 1) - 1;
+			int j = offset * (2 * local_id + 2) - 1;
+			temp[j + CONFLICT_FREE_OFFSET(j)] += temp[i + CONFLICT_FREE_OFFSET(i)];
 		}
-		
-	
-	
-	CH[global_id] = H_local[local_id] / 3;
+		offset *= 2;
 	}
 
+	//down-sweep
+	if (local_id == 0) temp[n - 1 + CONFLICT_FREE_OFFSET(n - 1)] = 0;
+
+	for (int d = 1; d < n; d *= 2)
+	{
+		offset /= 2;
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		if (local_id < d)
+		{
+			int i = offset * (2 * local_id + 1) - 1;
+			int j = offset * (2 * local_id + 2) - 1;
+			uint temp_value = temp[i + CONFLICT_FREE_OFFSET(i)];
+
+			temp[i + CONFLICT_FREE_OFFSET(i)] = temp[j + CONFLICT_FREE_OFFSET(j)];
+			temp[j + CONFLICT_FREE_OFFSET(j)] += temp_value;
+		}
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	store_chist(CH, LUT, block_start + ai, temp[ai + CONFLICT_FREE_OFFSET(ai)] + a, max_value, pixel_count);
+	store_chist(CH, LUT, block_start + bi, temp[bi + CONFLICT_FREE_OFFSET(bi)] + b, max_value, pixel_count);
+}
+
 //helper kernel with scanned block sums
 kernel void get_B_S(global const uint* CH, global uint* BS, const uint local_elements)
 {
@@ -89,38 +560,27 @@ kernel void get_B_S(global const uint* CH, global uint* BS, const uint local_ele
 	BS[global_id] = CH[(global_id + 1) * local_elements - 1];
 	}
 	
-//performing an exclusive scan
-kernel void get_scanned_BS_1(global const uint* BS, global uint* BS_scanned)
-{
-	int global_id = get_global_id(0);
-	
-	
-	int size = get_global_size(0);
-	
-	for (int i = global_id + 1; i < size && global_id < size; i++)
-	{
-		atomic_add(&BS_scanned[i], BS[global_id]);
-	}
-}
-
 //exclusive scan using Blelloch method
+//each workgroup scans the block sums of one channel
 kernel void get_scanned_BS_2(global uint* BS)
 {
-	int global_id = get_global_id(0);
-	int size = get_global_size(0);
+	int local_id = get_local_id(0);
+	int size = get_local_size(0);
 	int temp_value; //used as a temp value
+
+	BS += get_group_id(0) * size;
 	
 	//up-sweep
 	for (int i = 1; i < size; i *= 2)
 	{
-		if (((global_id + 1) % (i * 2)) == 0) BS[global_id] += BS[global_id - i];
+		if (((local_id + 1) % (i * 2)) == 0) BS[local_id] += BS[local_id - i];
 
 		
 		
 	barrier(CLK_GLOBAL_MEM_FENCE); }
 	
 	//down sweep
-	if (global_id == 0) BS[size - 1] = 0;
+	if (local_id == 0) BS[size - 1] = 0;
 
 	
 	
@@ -130,15 +590,15 @@ kernel void get_scanned_BS_2(global uint* BS)
 	
 	for (int i = size / 2; i > 0; i /= 2)
 	{
-		if (((global_id + 1) % (i * 2)) == 0)
+		if (((local_id + 1) % (i * 2)) == 0)
 		{
-			temp_value = BS[global_id];
+			temp_value = BS[local_id];
 			
 			
-			BS[global_id] += BS[global_id - i];
+			BS[local_id] += BS[local_id - i];
 			
 			
-			BS[global_id - i] = temp_value;
+			BS[local_id - i] = temp_value;
 		}
 		
 		
@@ -152,25 +612,480 @@ kernel void get_complete_chist(global const uint* BS_scanned, global uint* CH)
 	CH[get_global_id(0)] += BS_scanned[get_group_id(0)];
 }
 
+//cumulative histogram of BIN_COUNT bins in a single workgroup, one workgroup per channel
+//every work-item scans a strip of BIN_COUNT / local_size consecutive bins, the strip totals are scanned in local memory
+//and added back, so a 12bit image needs no block sum helper kernels
+//the local size has to be a power of two no larger than BIN_COUNT
+kernel void get_chist_BC(global const uint* H, global uint* CH, local uint* A, local uint* B,
+	global LUT_TYPE* LUT, const uint max_value, const uint pixel_count)
+{
+	int local_id = get_local_id(0);
+	int strip = BIN_COUNT / get_local_size(0);
+	int strip_start = get_group_id(0) * BIN_COUNT + local_id * strip;
+	uint total = 0;
+
+	for (int i = 0; i < strip; i++) total += H[strip_start + i];
+
+	uint sum = local_scan(total, A, B) - total; //exclusive strip offset
+
+	for (int i = 0; i < strip; i++)
+	{
+		sum += H[strip_start + i];
+		store_chist(CH, LUT, strip_start + i, sum, max_value, pixel_count);
+	}
+}
+
+//multi-level scan of segmented arrays of any length (one segment per channel histogram) with any workgroup size
+//a segment of segment_elements values is split into blocks of local_size values that never span two segments;
+//every block is scanned in local memory and its total written to block_sums, which is laid out as segments of
+//blocks-per-segment values, so the host scans the block sums with the same kernel until one block per segment is left
+//in and out may be the same buffer; LUT is only passed when a single level covers the segments
+kernel void get_scan_blocks(global const uint* in, global uint* out, global uint* block_sums, const uint segment_elements,
+	local uint* A, local uint* B, global LUT_TYPE* LUT, const uint max_value, const uint pixel_count)
+{
+	uint local_size = get_local_size(0);
+	uint segment_blocks = (segment_elements + local_size - 1) / local_size;
+	uint index = (get_group_id(0) % segment_blocks) * local_size + get_local_id(0); //index within the segment
+	uint global_index = (get_group_id(0) / segment_blocks) * segment_elements + index;
+
+	uint value = local_scan(index < segment_elements ? in[global_index] : 0, A, B); //inclusive within the block
+
+	if (index < segment_elements) store_chist(out, LUT, global_index, value, max_value, pixel_count);
+
+	if (get_local_id(0) == local_size - 1) block_sums[get_group_id(0)] = value;
+}
+
+//register-blocked version of get_scan_blocks, blocks cover SCAN_STRIP * local_size values
+//every work-item loads SCAN_STRIP consecutive values, scans them serially in private memory and takes part in a local scan
+//of the strip totals only, so a block needs a single workgroup scan for SCAN_STRIP times as many values
+//block_sums may be NULL when every segment fits in one block
+kernel void get_scan_blocks_RB(global const uint* in, global uint* out, global uint* block_sums, const uint segment_elements,
+	local uint* A, local uint* B, global LUT_TYPE* LUT, const uint max_value, const uint pixel_count)
+{
+	uint block_elements = SCAN_STRIP * get_local_size(0);
+	uint segment_blocks = (segment_elements + block_elements - 1) / block_elements;
+	uint index = (get_group_id(0) % segment_blocks) * block_elements + get_local_id(0) * SCAN_STRIP; //start of the strip
+	uint global_index = (get_group_id(0) / segment_blocks) * segment_elements + index;
+	uint strip[SCAN_STRIP];
+	uint total = 0;
+
+	for (int i = 0; i < SCAN_STRIP; i++)
+	{
+		total += index + i < segment_elements ? in[global_index + i] : 0;
+		strip[i] = total;
+	}
+
+	uint offset = local_scan(total, A, B) - total; //exclusive strip offset
+
+	for (int i = 0; i < SCAN_STRIP; i++)
+		if (index + i < segment_elements) store_chist(out, LUT, global_index + i, strip[i] + offset, max_value, pixel_count);
+
+	if (block_sums && get_local_id(0) == get_local_size(0) - 1) block_sums[get_group_id(0)] = offset + total;
+}
+
+//propagates the scanned block sums of the level above back into a level of the multi-level scan,
+//launched with the same groups as the block scan of that level (blocks of block_elements values);
+//the first block of every segment has nothing to add, it only writes its LUT entries when LUT is passed (first level)
+kernel void get_add_block_sums(global uint* data, global const uint* scanned_block_sums, const uint segment_elements, const uint block_elements,
+	global LUT_TYPE* LUT, const uint max_value, const uint pixel_count)
+{
+	uint segment_blocks = (segment_elements + block_elements - 1) / block_elements;
+	uint block = get_group_id(0) % segment_blocks;
+	uint segment_start = (get_group_id(0) / segment_blocks) * segment_elements;
+
+	if (block == 0 && !LUT) return;
+
+	uint block_sum = block ? scanned_block_sums[get_group_id(0) - 1] : 0;
+
+	for (uint i = get_local_id(0); i < block_elements; i += get_local_size(0))
+	{
+		uint index = block * block_elements + i;
+		if (index < segment_elements) store_chist(block ? data : 0, LUT, segment_start + index, data[segment_start + index] + block_sum, max_value, pixel_count);
+	}
+}
+
+//single-pass cumulative histogram using a decoupled look-back scan
+//every block of local_size bins takes a ticket from status[0], so blocks are numbered in the order they are scheduled
+//and only ever wait on blocks that are already running; a block scans its bins in local memory, publishes its aggregate,
+//walks back over its predecessors adding their aggregates until it meets an inclusive prefix, then publishes its own
+//status holds 1 + 3 * blocks zeroes before the launch: a flag (1 = aggregate, 2 = inclusive prefix), the aggregate and the prefix
+//per block, the aggregate and prefix are written before the flag so a reader never sees a flag without its value
+//for per-channel histograms the look-back stops at the first block of the channel (channel_blocks blocks per channel)
+kernel void get_chist_LB(global const uint* H, global uint* CH, global uint* status, const uint channel_blocks, local uint* A, local uint* B,
+	global LUT_TYPE* LUT, const uint max_value, const uint pixel_count)
+{
+	local uint block_local, prefix_local;
+	int local_id = get_local_id(0);
+	int local_size = get_local_size(0);
+
+	if (local_id == 0) block_local = atomic_inc(&status[0]);
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	uint block = block_local;
+	uint global_id = block * local_size + local_id;
+	uint value = local_scan(H[global_id], A, B); //inclusive within the block
+	global uint* block_status = status + 1 + 3 * block;
+
+	if (local_id == local_size - 1)
+	{
+		uint prefix = 0; //sum of all bins of the channel before this block
+
+		if (block % channel_blocks)
+		{
+			atomic_xchg(&block_status[1], value);
+			mem_fence(CLK_GLOBAL_MEM_FENCE);
+			atomic_xchg(&block_status[0], 1);
+
+			for (uint i = block - 1; ; i--)
+			{
+				global uint* previous_status = status + 1 + 3 * i;
+				uint flag;
+
+				do flag = atomic_or(&previous_status[0], 0); while (flag == 0); //wait for the predecessor to publish
+
+				mem_fence(CLK_GLOBAL_MEM_FENCE);
+
+				if (flag == 2)
+				{
+					prefix += atomic_or(&previous_status[2], 0);
+					break;
+				}
+				prefix += atomic_or(&previous_status[1], 0);
+			}
+		}
+
+		atomic_xchg(&block_status[2], prefix + value);
+		mem_fence(CLK_GLOBAL_MEM_FENCE);
+		atomic_xchg(&block_status[0], 2);
+
+		prefix_local = prefix;
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	store_chist(CH, LUT, global_id, value + prefix_local, max_value, pixel_count);
+}
+
+//fused 8bit histogram, cumulative histogram and LUT in a single launch, local elements should equal 256
+//every group flushes its local histogram into H_sum and then takes a ticket from counter; the group with the last ticket
+//sees every flush, so it scans the 256 bins, writes H, CH and the LUT and clears H_sum and counter for the next launch
+//H_sum and counter have to be zeroed once when they are created, H, CH and LUT are written completely and need no fill
+//CH may be NULL when the c-hist is not kept
+//the totals only go through atomics, and every flush is fenced before the ticket of its group; on OpenCL C 2.0 the ticket is
+//also a device scope acquire-release, so the flushes of every group are visible to the last one
+#if __OPENCL_C_VERSION__ >= 200 && (__OPENCL_C_VERSION__ < 300 || (defined(__opencl_c_atomic_order_acq_rel) && defined(__opencl_c_atomic_scope_device)))
+#define DEVICE_SCOPE_TICKET
+#endif
+kernel void get_hist_LUT_8(global const uchar* image, global uint* H, global uint* CH, global LUT_TYPE* LUT, global uint* H_sum,
+	global uint* counter, local uint* H_local, local uint* A, local uint* B, const uint image_elements, const int max_value)
+{
+	local uint ticket;
+	int global_id = get_global_id(0);
+	int local_id = get_local_id(0);
+
+	if (local_id < 256) H_local[local_id] = 0; //set local hist to 0
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (global_id < image_elements) atomic_inc(&H_local[image[global_id]]);
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (local_id < 256 && H_local[local_id])
+	{
+		atomic_add(&H_sum[local_id], H_local[local_id]);
+		mem_fence(CLK_GLOBAL_MEM_FENCE);
+	}
+
+	//the flush of the whole group has to reach global memory before the ticket is taken
+#ifdef DEVICE_SCOPE_TICKET
+	work_group_barrier(CLK_GLOBAL_MEM_FENCE, memory_scope_device);
+
+	if (local_id == 0) ticket = atomic_fetch_add_explicit((volatile global atomic_uint*)counter, 1, memory_order_acq_rel, memory_scope_device);
+
+	work_group_barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE, memory_scope_device);
+#else
+	barrier(CLK_GLOBAL_MEM_FENCE);
+
+	if (local_id == 0) ticket = atomic_inc(counter);
+
+	barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+#endif
+
+	if (ticket != get_num_groups(0) - 1) return;
+
+	//last group: read and clear the totals, scan them and normalise the c-hist into the LUT
+	uint value = local_id < 256 ? atomic_xchg(&H_sum[local_id], 0) : 0;
+	uint cumulative = local_scan(value, A, B);
+
+	if (local_id < 256)
+	{
+		H[local_id] = value;
+		store_chist(CH, LUT, local_id, cumulative, max_value, image_elements);
+	}
+
+	if (local_id == 0) atomic_xchg(counter, 0);
+}
+
+//sort-based 16bit histogram engine
+//the pixels are sorted with an LSD radix sort over four 4-bit digits, then the histogram and
+//cumulative histogram are read off the run boundaries of the sorted keys, so no atomics touch H or CH
+
+//digit counts of one radix pass
+//every workgroup owns a contiguous chunk of the keys; the counts are stored digit-major (counts[digit * groups + group])
+//so that a scan over the whole array gives the scatter offset of every digit of every group
+kernel void get_radix_counts(global const ushort* keys, global uint* counts, const uint elements, const uint shift)
+{
+	local uint counts_local[16];
+	int local_id = get_local_id(0);
+	uint group_id = get_group_id(0);
+	uint groups = get_num_groups(0);
+	uint chunk = (elements + groups - 1) / groups;
+	uint start = group_id * chunk;
+	uint end = min(start + chunk, elements);
+
+	if (local_id < 16) counts_local[local_id] = 0;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint i = start + local_id; i < end; i += get_local_size(0)) atomic_inc(&counts_local[(keys[i] >> shift) & 15]);
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (local_id < 16) counts[local_id * groups + group_id] = counts_local[local_id];
+}
+
+//stable scatter of one radix pass, launched with the same groups as get_radix_counts
+//offsets is the inclusive scan of counts; each group walks its chunk in tiles of local_size keys,
+//sorts a tile by the digit in local memory with four 1-bit splits and writes every key after the keys
+//with the same digit from earlier tiles and groups
+kernel void get_radix_scatter(global const ushort* keys, global ushort* sorted, global const uint* counts, global const uint* offsets,
+	const uint elements, const uint shift, local ushort* tile, local uint* A, local uint* B)
+{
+	local uint digit_offsets[16];
+	local uint run_start[16];
+	local uint zeros_total;
+	int local_id = get_local_id(0);
+	int local_size = get_local_size(0);
+	uint group_id = get_group_id(0);
+	uint groups = get_num_groups(0);
+	uint chunk = (elements + groups - 1) / groups;
+	uint start = group_id * chunk;
+	uint end = min(start + chunk, elements);
+
+	//exclusive offset of every digit for this group
+	if (local_id < 16) digit_offsets[local_id] = offsets[local_id * groups + group_id] - counts[local_id * groups + group_id];
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint tile_start = start; tile_start < end; tile_start += local_size)
+	{
+		uint tile_count = min((uint)local_size, end - tile_start);
+
+		//keys past the end of the chunk sort behind every valid key with digit 15
+		ushort key = local_id < tile_count ? keys[tile_start + local_id] : 0xFFFF;
+
+		for (uint b = 0; b < 4; b++)
+		{
+			uint zero = ((key >> (shift + b)) & 1) == 0;
+			uint zeros_before = local_scan(zero, A, B); //inclusive
+
+			if (local_id == local_size - 1) zeros_total = zeros_before;
+
+			barrier(CLK_LOCAL_MEM_FENCE);
+
+			tile[zero ? zeros_before - 1 : zeros_total + local_id - zeros_before] = key;
+
+			barrier(CLK_LOCAL_MEM_FENCE);
+
+			key = tile[local_id];
+
+			barrier(CLK_LOCAL_MEM_FENCE);
+		}
+
+		uint digit = (key >> shift) & 15;
+
+		//the tile is now sorted by digit, mark where every digit run starts
+		if (local_id < tile_count && (local_id == 0 || ((tile[local_id - 1] >> shift) & 15) != digit)) run_start[digit] = local_id;
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		uint rank = local_id - run_start[digit];
+
+		if (local_id < tile_count) sorted[digit_offsets[digit] + rank] = key;
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		//the last key of every run moves the digit offset past this tile
+		if (local_id < tile_count && (local_id == tile_count - 1 || ((tile[local_id + 1] >> shift) & 15) != digit)) digit_offsets[digit] += rank + 1;
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+}
+
+//cumulative histogram from the run boundaries of the sorted keys
+//at every boundary between values a < b the bins a .. b-1 hold the number of keys up to the boundary,
+//CH has to be filled with 0 beforehand for the bins below the smallest key
+kernel void get_chist_sorted(global const ushort* sorted, global uint* CH, const uint elements)
+{
+	uint global_id = get_global_id(0);
+	uint a = sorted[global_id];
+	uint b = global_id + 1 < elements ? sorted[global_id + 1] : BIN_COUNT;
+
+	for (uint i = a; i < b; i++) CH[i] = global_id + 1;
+}
+
+//histogram as the difference of neighbouring cumulative histogram bins
+kernel void get_hist_from_chist(global const uint* CH, global uint* H)
+{
+	int global_id = get_global_id(0);
+	H[global_id] = CH[global_id] - (global_id ? CH[global_id - 1] : 0);
+}
+
 //normalised c-hist as an LUT
-kernel void get_LUT(global uint* CH, global uint* LUT, const int bin_count, const int pixel_count)
+//pixel_count is the number of elements counted by each histogram, one work-item per LUT entry of every channel
+//max_value is the maxval of the image, so the output keeps the bit depth of the input
+//only the basic and sort-based c-hists need it, the optimised scans write the LUT themselves
+kernel void get_LUT(global uint* CH, global LUT_TYPE* LUT, const int max_value, const int pixel_count)
 {
 	int global_id = get_global_id(0);
 	
 	//ulong is needed so it doesnt overflow past the int
-	if (global_id < bin_count) LUT[global_id] = ((ulong)CH[global_id] * (bin_count - 1)) / pixel_count;
+	LUT[global_id] = ((ulong)CH[global_id] * max_value) / pixel_count;
 }
 
 //getting the 8bit image output
-kernel void get_Output8(global const uchar* input_image, global const uint* LUT, global uchar* output_image)
+kernel void get_Output8(global const uchar* input_image, global const LUT_TYPE* LUT, global uchar* output_image)
 {
 	uint global_id = get_global_id(0);
 	output_image[global_id] = LUT[input_image[global_id]]; //getting the output image from the LUT value from the altered input image
 }
 
 //getting the 16bit image output
-kernel void get_Output16(global const ushort* input_image, global const uint* LUT, global ushort* output_image)
+kernel void get_Output16(global const ushort* input_image, global const LUT_TYPE* LUT, global ushort* output_image)
 {
 	uint global_id = get_global_id(0);
-	output_image[global_id] = LUT[input_image[global_id]]; //getting the output image from the 16bit LUT values from the altered input image
-}
\ No newline at end of file
+	output_image[global_id] = PIXEL16(LUT[PIXEL16(input_image[global_id])]); //getting the output image from the 16bit LUT values from the altered input image
+}
+
+//per-channel 8bit image output, each channel plane is mapped through its own LUT
+kernel void get_Output8_C(global const uchar* input_image, global const LUT_TYPE* LUT, global uchar* output_image, const uint plane_elements)
+{
+	uint global_id = get_global_id(0);
+	output_image[global_id] = LUT[CHANNEL_OF(global_id, plane_elements) * 256 + input_image[global_id]];
+}
+
+//per-channel 16bit image output
+kernel void get_Output16_C(global const ushort* input_image, global const LUT_TYPE* LUT, global ushort* output_image, const uint plane_elements)
+{
+	uint global_id = get_global_id(0);
+	output_image[global_id] = PIXEL16(LUT[CHANNEL_OF(global_id, plane_elements) * BIN_COUNT + PIXEL16(input_image[global_id])]);
+}
+
+//8bit luminance-only output
+//Y/Cb/Cr are recomputed per pixel, the LUT is applied to Y and RGB is written back in the same pass;
+//Cb and Cr are kept centred on 0 since the offsets cancel out in the inverse transform
+kernel void get_Output_Y8(global const uchar* input_image, global const LUT_TYPE* LUT, global uchar* output_image, const uint plane_elements)
+{
+	uint global_id = get_global_id(0);
+	uint R_index = CHANNEL_ELEMENT(global_id, 0, plane_elements), G_index = CHANNEL_ELEMENT(global_id, 1, plane_elements),
+		B_index = CHANNEL_ELEMENT(global_id, 2, plane_elements);
+	float R = input_image[R_index], G = input_image[G_index], B = input_image[B_index];
+
+	float Y = LUT[convert_uchar_sat_rte(get_Y(R, G, B))];
+	float Cb = -0.168736f * R - 0.331264f * G + 0.5f * B;
+	float Cr = 0.5f * R - 0.418688f * G - 0.081312f * B;
+
+	output_image[R_index] = convert_uchar_sat_rte(Y + 1.402f * Cr);
+	output_image[G_index] = convert_uchar_sat_rte(Y - 0.344136f * Cb - 0.714136f * Cr);
+	output_image[B_index] = convert_uchar_sat_rte(Y + 1.772f * Cb);
+}
+
+//16bit luminance-only output
+//the channels are clamped to the maxval of the image so images below 16 bits stay within their bit depth
+kernel void get_Output_Y16(global const ushort* input_image, global const LUT_TYPE* LUT, global ushort* output_image, const uint plane_elements,
+	const uint max_value)
+{
+	uint global_id = get_global_id(0);
+	uint R_index = CHANNEL_ELEMENT(global_id, 0, plane_elements), G_index = CHANNEL_ELEMENT(global_id, 1, plane_elements),
+		B_index = CHANNEL_ELEMENT(global_id, 2, plane_elements);
+	float R = PIXEL16(input_image[R_index]), G = PIXEL16(input_image[G_index]), B = PIXEL16(input_image[B_index]);
+
+	float Y = LUT[convert_ushort_sat_rte(get_Y(R, G, B))];
+	float Cb = -0.168736f * R - 0.331264f * G + 0.5f * B;
+	float Cr = 0.5f * R - 0.418688f * G - 0.081312f * B;
+
+	output_image[R_index] = PIXEL16(convert_ushort_sat_rte(min(Y + 1.402f * Cr, (float)max_value)));
+	output_image[G_index] = PIXEL16(convert_ushort_sat_rte(min(Y - 0.344136f * Cb - 0.714136f * Cr, (float)max_value)));
+	output_image[B_index] = PIXEL16(convert_ushort_sat_rte(min(Y + 1.772f * Cb, (float)max_value)));
+}
+
+//vectorised 8bit image output, 16 pixels are loaded and stored per work-item
+//the host handles the tail of the image that is not a multiple of 16 with get_Output8
+kernel void get_Output8_V(global const uchar* input_image, global const LUT_TYPE* LUT, global uchar* output_image)
+{
+	uint global_id = get_global_id(0);
+	uchar16 p = vload16(global_id, input_image);
+
+	uchar16 output = (uchar16)(LUT[p.s0], LUT[p.s1], LUT[p.s2], LUT[p.s3], LUT[p.s4], LUT[p.s5], LUT[p.s6], LUT[p.s7],
+		LUT[p.s8], LUT[p.s9], LUT[p.sa], LUT[p.sb], LUT[p.sc], LUT[p.sd], LUT[p.se], LUT[p.sf]);
+
+	vstore16(output, global_id, output_image);
+}
+
+//vectorised 16bit image output, 8 pixels are loaded and stored per work-item
+kernel void get_Output16_V(global const ushort* input_image, global const LUT_TYPE* LUT, global ushort* output_image)
+{
+	uint global_id = get_global_id(0);
+	ushort8 p = PIXEL16_8(vload8(global_id, input_image));
+
+	ushort8 output = (ushort8)(LUT[p.s0], LUT[p.s1], LUT[p.s2], LUT[p.s3], LUT[p.s4], LUT[p.s5], LUT[p.s6], LUT[p.s7]);
+
+	vstore8(PIXEL16_8(output), global_id, output_image);
+}
+//vectorised 8bit image output with the LUT cached in local memory
+//a bounded number of groups is launched; every group copies the 256 LUT entries once and then walks the image with a
+//grid-stride loop of 16 pixels per work-item, so the gathers hit local memory and global memory only sees the pixels
+kernel void get_Output8_LV(global const uchar* input_image, global const LUT_TYPE* LUT, global uchar* output_image, local LUT_TYPE* LUT_local,
+	const uint vector_elements)
+{
+	for (int i = get_local_id(0); i < 256; i += get_local_size(0)) LUT_local[i] = LUT[i];
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint i = get_global_id(0); i < vector_elements; i += get_global_size(0))
+	{
+		uchar16 p = vload16(i, input_image);
+
+		vstore16((uchar16)(LUT_local[p.s0], LUT_local[p.s1], LUT_local[p.s2], LUT_local[p.s3], LUT_local[p.s4], LUT_local[p.s5], LUT_local[p.s6], LUT_local[p.s7],
+			LUT_local[p.s8], LUT_local[p.s9], LUT_local[p.sa], LUT_local[p.sb], LUT_local[p.sc], LUT_local[p.sd], LUT_local[p.se], LUT_local[p.sf]), i, output_image);
+	}
+}
+
+//vectorised 16bit image output with the LUT cached in local memory, for bin counts whose LUT fits (e.g. 8KB for a 12bit image)
+kernel void get_Output16_LV(global const ushort* input_image, global const LUT_TYPE* LUT, global ushort* output_image, local LUT_TYPE* LUT_local,
+	const uint vector_elements)
+{
+	for (int i = get_local_id(0); i < BIN_COUNT; i += get_local_size(0)) LUT_local[i] = LUT[i];
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint i = get_global_id(0); i < vector_elements; i += get_global_size(0))
+	{
+		ushort8 p = PIXEL16_8(vload8(i, input_image));
+
+		vstore8(PIXEL16_8((ushort8)(LUT_local[p.s0], LUT_local[p.s1], LUT_local[p.s2], LUT_local[p.s3], LUT_local[p.s4], LUT_local[p.s5], LUT_local[p.s6], LUT_local[p.s7])), i, output_image);
+	}
+}
+
+//vectorised 16bit image output reading a LUT too large for local memory through the constant cache
+kernel void get_Output16_CV(global const ushort* input_image, constant LUT_TYPE* LUT, global ushort* output_image, const uint vector_elements)
+{
+	for (uint i = get_global_id(0); i < vector_elements; i += get_global_size(0))
+	{
+		ushort8 p = PIXEL16_8(vload8(i, input_image));
+
+		vstore8(PIXEL16_8((ushort8)(LUT[p.s0], LUT[p.s1], LUT[p.s2], LUT[p.s3], LUT[p.s4], LUT[p.s5], LUT[p.s6], LUT[p.s7])), i, output_image);
+	}
+}
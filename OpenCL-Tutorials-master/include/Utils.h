@@ -7,7 +7,7 @@
 
 #define CL_USE_DEPRECATED_OPENCL_1_2_APIS
 #define CL_HPP_MINIMUM_OPENCL_VERSION 120
-#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_TARGET_OPENCL_VERSION 200
 #define CL_HPP_ENABLE_EXCEPTIONS
 
 #include <CL/cl2.hpp>
@@ -24,13 +24,13 @@ ostream& operator<< (ostream& out, const vector<T>& v) {
 	return out;
 }
 
-string GetPlatformName(int platform_id) {
+inline string GetPlatformName(int platform_id) {
 	vector<cl::Platform> platforms;
 	cl::Platform::get(&platforms);
 	return platforms[platform_id].getInfo<CL_PLATFORM_NAME>();
 }
 
-string GetDeviceName(int platform_id, int device_id) {
+inline string GetDeviceName(int platform_id, int device_id) {
 	vector<cl::Platform> platforms;
 	cl::Platform::get(&platforms);
 	vector<cl::Device> devices;
@@ -38,7 +38,7 @@ string GetDeviceName(int platform_id, int device_id) {
 	return devices[device_id].getInfo<CL_DEVICE_NAME>();
 }
 
-const char *getErrorString(cl_int error) {
+inline const char *getErrorString(cl_int error) {
 	switch (error){
 		// run-time and JIT compiler errors
 	case 0: return "CL_SUCCESS";
@@ -114,21 +114,21 @@ const char *getErrorString(cl_int error) {
 	}
 }
 
-void CheckError(cl_int error) {
+inline void CheckError(cl_int error) {
 	if (error != CL_SUCCESS) {
 		cerr << "OpenCL call failed with error " << getErrorString(error) << endl;
 		exit(1);
 	}
 }
 
-void AddSources(cl::Program::Sources& sources, const string& file_name) {
+inline void AddSources(cl::Program::Sources& sources, const string& file_name) {
 	//TODO: add file existence check
 	ifstream file(file_name);
 	string* source_code = new string(istreambuf_iterator<char>(file), (istreambuf_iterator<char>()));
 	sources.push_back((*source_code).c_str());
 }
 
-string ListPlatformsDevices() {
+inline string ListPlatformsDevices() {
 
 	stringstream sstream;
 	vector<cl::Platform> platforms;
@@ -178,7 +178,7 @@ string ListPlatformsDevices() {
 	return sstream.str();
 }
 
-cl::Context GetContext(int platform_id, int device_id) {
+inline cl::Context GetContext(int platform_id, int device_id) {
 	vector<cl::Platform> platforms;
 
 	cl::Platform::get(&platforms);
@@ -205,7 +205,7 @@ enum ProfilingResolution {
 	PROF_S = 1000000000
 };
 
-string GetFullProfilingInfo(const cl::Event& evnt, ProfilingResolution resolution) {
+inline string GetFullProfilingInfo(const cl::Event& evnt, ProfilingResolution resolution) {
 	stringstream sstream;
 
 	sstream << "Queued " << (evnt.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>() - evnt.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>()) / resolution;